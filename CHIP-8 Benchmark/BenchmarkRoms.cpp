@@ -0,0 +1,80 @@
+#include "BenchmarkRoms.h"
+
+// Maze by David Winter, public domain. Draws a random maze of diagonal lines,
+// then spins on a jump.
+static const uint8_t MAZE[] = {
+	0xA2, 0x1E, 0xC2, 0x01, 0x32, 0x01, 0xA2, 0x1A, 0xD0, 0x14, 0x70, 0x04,
+	0x30, 0x40, 0x12, 0x00, 0x60, 0x00, 0x71, 0x04, 0x31, 0x20, 0x12, 0x00,
+	0x12, 0x18, 0x80, 0x40, 0x20, 0x10, 0x20, 0x40, 0x80, 0x10,
+};
+
+// Written for this benchmark and released with it. Counts up forever, clearing
+// the screen and drawing the count as three decimal digits every time.
+static const uint8_t COUNTER[] = {
+	0x6A, 0x00, // 200: VA = 0
+	0x00, 0xE0, // 202: CLS
+	0xAE, 0x00, // 204: I = E00
+	0xFA, 0x33, // 206: BCD VA
+	0xF2, 0x65, // 208: V0..V2 = digits
+	0x6B, 0x00, // 20A: VB = 0
+	0x6C, 0x00, // 20C: VC = 0
+	0xF0, 0x29, // 20E: I = glyph V0
+	0xDB, 0xC5, // 210: draw
+	0x7B, 0x05, // 212: VB += 5
+	0xF1, 0x29, // 214: I = glyph V1
+	0xDB, 0xC5, // 216: draw
+	0x7B, 0x05, // 218: VB += 5
+	0xF2, 0x29, // 21A: I = glyph V2
+	0xDB, 0xC5, // 21C: draw
+	0x7A, 0x01, // 21E: VA += 1
+	0x12, 0x02, // 220: jump 202
+};
+
+// Written for this benchmark and released with it. Tiles the screen with an
+// 8x8 sprite over and over, toggling every pixel.
+static const uint8_t TILES[] = {
+	0xA2, 0x1A, // 200: I = sprite
+	0x60, 0x00, // 202: V0 = 0
+	0x61, 0x00, // 204: V1 = 0
+	0xD0, 0x18, // 206: draw 8 rows at V0, V1
+	0x70, 0x08, // 208: V0 += 8
+	0x30, 0x40, // 20A: skip if V0 == 64
+	0x12, 0x06, // 20C: jump 206
+	0x60, 0x00, // 20E: V0 = 0
+	0x71, 0x08, // 210: V1 += 8
+	0x31, 0x20, // 212: skip if V1 == 32
+	0x12, 0x06, // 214: jump 206
+	0x61, 0x00, // 216: V1 = 0
+	0x12, 0x06, // 218: jump 206
+	0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF, // 21A: sprite
+};
+
+// Written for this benchmark and released with it. Steps a Fibonacci sequence
+// modulo 256 and an 8-bit LFSR, storing both to memory through a subroutine.
+static const uint8_t ARITHMETIC[] = {
+	0x60, 0x00, // 200: V0 = 0
+	0x61, 0x01, // 202: V1 = 1
+	0x63, 0xB8, // 204: V3 = B8 (LFSR taps)
+	0x64, 0x01, // 206: V4 = 1 (LFSR state)
+	0x82, 0x00, // 208: V2 = V0
+	0x82, 0x14, // 20A: V2 += V1
+	0x80, 0x10, // 20C: V0 = V1
+	0x81, 0x20, // 20E: V1 = V2
+	0x84, 0x46, // 210: V4 >>= 1, VF = carry
+	0x3F, 0x00, // 212: skip if VF == 0
+	0x84, 0x33, // 214: V4 ^= V3
+	0x22, 0x1A, // 216: call 21A
+	0x12, 0x08, // 218: jump 208
+	0xAE, 0x00, // 21A: I = E00
+	0xF4, 0x55, // 21C: store V0..V4
+	0x00, 0xEE, // 21E: return
+};
+
+const BenchmarkRom BENCHMARK_ROMS[] = {
+	{ "maze", MAZE, sizeof(MAZE) },
+	{ "counter", COUNTER, sizeof(COUNTER) },
+	{ "tiles", TILES, sizeof(TILES) },
+	{ "arithmetic", ARITHMETIC, sizeof(ARITHMETIC) },
+};
+
+const size_t BENCHMARK_ROM_COUNT = sizeof(BENCHMARK_ROMS) / sizeof(BENCHMARK_ROMS[0]);
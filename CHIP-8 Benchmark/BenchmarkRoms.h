@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// ROM images compiled into the benchmark so results don't depend on files on disk
+struct BenchmarkRom {
+	const char* name;
+	const uint8_t* data;
+	size_t size;
+};
+
+extern const BenchmarkRom BENCHMARK_ROMS[];
+extern const size_t BENCHMARK_ROM_COUNT;
@@ -0,0 +1,527 @@
+#include "Benchmarks.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+
+#include "Chip8.h"
+#include "Chip8Batch.h"
+#include "Chip8Jit.h"
+#include "BenchmarkRoms.h"
+
+// Three kinds of benchmark:
+//  opcode   one OP_* handler repeated in a straight line, run through cycle()
+//  mix      a random instruction mix of one flavour, run through every engine
+//  rom      a bundled ROM, run through every engine
+// Mixes and ROMs also run on Chip8Batch lanes, each lane with its own RNG seed,
+// timed per lane-instruction and checked lane by lane against Chip8.
+// Timers are never ticked, so every run executes exactly the instructions asked for.
+
+namespace {
+	enum class Engine {
+		CYCLE,
+		BATCH,
+		JIT
+	};
+
+	const char* engineName(Engine engine) {
+		switch (engine) {
+			case Engine::CYCLE:
+				return "cycle";
+			case Engine::BATCH:
+				return "batch";
+			default:
+				return "jit";
+		}
+	}
+
+	struct Program {
+		std::vector<uint8_t> rom;
+		// Keypad state held for the whole run, one bit per key
+		uint16_t keys = 0;
+	};
+
+	// Copies of the body in a straight-line benchmark, enough to make the jump
+	// back to the top negligible
+	const unsigned COPIES = 128;
+
+	// Mixes call a subroutine here that just returns
+	const uint16_t SUBROUTINE_ADDRESS = 0x600;
+	// Instructions generated per mix before it jumps back to its start
+	const unsigned MIX_LENGTH = 400;
+
+	uint16_t address(const Program& program) {
+		return static_cast<uint16_t>(ROM_START_ADDRESS + program.rom.size());
+	}
+
+	void emit(Program& program, uint16_t opcode) {
+		program.rom.push_back(static_cast<uint8_t>(opcode >> 8));
+		program.rom.push_back(static_cast<uint8_t>(opcode));
+	}
+
+	// Runs setup once, then the body over and over
+	Program repeated(std::initializer_list<uint16_t> setup, std::initializer_list<uint16_t> body, uint16_t keys = 0) {
+		Program program;
+		program.keys = keys;
+		for (uint16_t opcode : setup) {
+			emit(program, opcode);
+		}
+
+		uint16_t loop = address(program);
+		for (unsigned i = 0; i < COPIES; i++) {
+			for (uint16_t opcode : body) {
+				emit(program, opcode);
+			}
+		}
+		emit(program, 0x1000 | loop);
+		return program;
+	}
+
+	// Runs setup once, then a ring of jumps each landing on the next: base | nnn
+	Program chained(std::initializer_list<uint16_t> setup, uint16_t base) {
+		Program program;
+		for (uint16_t opcode : setup) {
+			emit(program, opcode);
+		}
+
+		uint16_t loop = address(program);
+		for (unsigned i = 0; i < COPIES; i++) {
+			uint16_t target = i + 1 < COPIES ? address(program) + 2 : loop;
+			emit(program, base | target);
+		}
+		return program;
+	}
+
+	// Calls a subroutine that returns immediately, over and over
+	Program calls() {
+		Program program;
+		uint16_t subroutine = ROM_START_ADDRESS + 2 * (COPIES + 1);
+		for (unsigned i = 0; i < COPIES; i++) {
+			emit(program, 0x2000 | subroutine);
+		}
+		emit(program, 0x1000 | ROM_START_ADDRESS);
+		emit(program, 0x00EE);
+		return program;
+	}
+
+	struct OpcodeBenchmark {
+		const char* name;
+		Program program;
+	};
+
+	// One entry per Chip8 handler. Skips are set up never to be taken and Fx0A to
+	// find a key down, so every body stays a straight line.
+	std::vector<OpcodeBenchmark> opcodeBenchmarks() {
+		return {
+			{ "NULL", repeated({}, { 0x0123 }) },
+			{ "00E0", repeated({}, { 0x00E0 }) },
+			{ "2nnn+00EE", calls() },
+			{ "1nnn", chained({}, 0x1000) },
+			{ "3xkk", repeated({ 0x6000 }, { 0x3001 }) },
+			{ "4xkk", repeated({ 0x6000 }, { 0x4000 }) },
+			{ "5xy0", repeated({ 0x6000, 0x6101 }, { 0x5010 }) },
+			{ "6xkk", repeated({}, { 0x6012 }) },
+			{ "7xkk", repeated({}, { 0x7001 }) },
+			{ "8xy0", repeated({ 0x6105 }, { 0x8010 }) },
+			{ "8xy1", repeated({ 0x6105 }, { 0x8011 }) },
+			{ "8xy2", repeated({ 0x6105 }, { 0x8012 }) },
+			{ "8xy3", repeated({ 0x6105 }, { 0x8013 }) },
+			{ "8xy4", repeated({ 0x6105 }, { 0x8014 }) },
+			{ "8xy5", repeated({ 0x6105 }, { 0x8015 }) },
+			{ "8xy6", repeated({ 0x6105 }, { 0x8016 }) },
+			{ "8xy7", repeated({ 0x6105 }, { 0x8017 }) },
+			{ "8xyE", repeated({ 0x6105 }, { 0x801E }) },
+			{ "9xy0", repeated({ 0x6000, 0x6100 }, { 0x9010 }) },
+			{ "Annn", repeated({}, { 0xA300 }) },
+			{ "Bnnn", chained({ 0x6000 }, 0xB000) },
+			{ "Cxkk", repeated({}, { 0xC0FF }) },
+			{ "Dxyn", repeated({ 0xA050, 0x6000, 0x6100 }, { 0xD015 }) },
+			{ "Ex9E", repeated({ 0x6000 }, { 0xE09E }) },
+			{ "ExA1", repeated({ 0x6000 }, { 0xE0A1 }, 0x0001) },
+			{ "Fx07", repeated({}, { 0xF007 }) },
+			{ "Fx0A", repeated({}, { 0xF00A }, 0x0001) },
+			{ "Fx15", repeated({ 0x6000 }, { 0xF015 }) },
+			{ "Fx18", repeated({ 0x6000 }, { 0xF018 }) },
+			{ "Fx1E", repeated({ 0x6000, 0xAE00 }, { 0xF01E }) },
+			{ "Fx29", repeated({ 0x6007 }, { 0xF029 }) },
+			{ "Fx33", repeated({ 0x60FF, 0xAE00 }, { 0xF033 }) },
+			{ "Fx55", repeated({ 0xAE00 }, { 0xFF55 }) },
+			{ "Fx65", repeated({ 0xAE00 }, { 0xFF65 }) },
+		};
+	}
+
+	// Random instruction fragments for the mixes. V0-VD are scratch, VE only ever
+	// holds a key number and VF is left to the flag-setting instructions. I stays
+	// in the E00-EFF scratch area or the font, so nothing writes over the program:
+	// Fx29 only ever follows a load of a digit into its register.
+	uint16_t scratch(Xorshift32& random) {
+		return random.nextByte() % 14;
+	}
+
+	void fontFragment(Xorshift32& random, Program& program) {
+		uint16_t x = scratch(random);
+		emit(program, 0x6000 | (x << 8) | (random.nextByte() & 0xF));
+		emit(program, 0xF029 | (x << 8));
+	}
+
+	void aluFragment(Xorshift32& random, Program& program) {
+		static const uint16_t ARITHMETIC[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+		uint16_t x = scratch(random), y = scratch(random);
+		switch (random.nextByte() % 4) {
+			case 0:
+				emit(program, 0x6000 | (x << 8) | random.nextByte());
+				break;
+			case 1:
+				emit(program, 0x7000 | (x << 8) | random.nextByte());
+				break;
+			default:
+				emit(program, 0x8000 | (x << 8) | (y << 4) | ARITHMETIC[random.nextByte() % 9]);
+				break;
+		}
+	}
+
+	void branchFragment(Xorshift32& random, Program& program) {
+		uint16_t x = scratch(random), y = scratch(random);
+		switch (random.nextByte() % 6) {
+			case 0:
+				emit(program, 0x3000 | (x << 8) | random.nextByte());
+				break;
+			case 1:
+				emit(program, 0x4000 | (x << 8) | random.nextByte());
+				break;
+			case 2:
+				emit(program, 0x5000 | (x << 8) | (y << 4));
+				break;
+			case 3:
+				emit(program, 0x9000 | (x << 8) | (y << 4));
+				break;
+			case 4:
+				emit(program, 0x1000 | (address(program) + 2));
+				break;
+			default:
+				emit(program, 0x2000 | SUBROUTINE_ADDRESS);
+				break;
+		}
+	}
+
+	void memoryFragment(Xorshift32& random, Program& program) {
+		uint16_t x = scratch(random);
+		switch (random.nextByte() % 5) {
+			case 0:
+				emit(program, 0xAE00 | random.nextByte());
+				break;
+			case 1:
+				emit(program, 0xF033 | (x << 8));
+				break;
+			case 2:
+				emit(program, 0xF055 | (x << 8));
+				break;
+			case 3:
+				emit(program, 0xF065 | (x << 8));
+				break;
+			default:
+				fontFragment(random, program);
+				break;
+		}
+	}
+
+	void graphicsFragment(Xorshift32& random, Program& program) {
+		uint16_t x = scratch(random), y = scratch(random);
+		switch (random.nextByte() % 16) {
+			case 0:
+				emit(program, 0x00E0);
+				break;
+			case 1:
+			case 2:
+			case 3:
+				fontFragment(random, program);
+				break;
+			case 4:
+			case 5:
+			case 6:
+			case 7:
+				emit(program, 0x6000 | (x << 8) | random.nextByte());
+				break;
+			default:
+				emit(program, 0xD000 | (x << 8) | (y << 4) | (1 + random.nextByte() % 15));
+				break;
+		}
+	}
+
+	void systemFragment(Xorshift32& random, Program& program) {
+		uint16_t x = scratch(random);
+		switch (random.nextByte() % 6) {
+			case 0:
+				emit(program, 0xF007 | (x << 8));
+				break;
+			case 1:
+				emit(program, 0xF015 | (x << 8));
+				break;
+			case 2:
+				emit(program, 0xF018 | (x << 8));
+				break;
+			case 3:
+				emit(program, 0x6E00 | (random.nextByte() & 0xF));
+				break;
+			case 4:
+				emit(program, (random.nextByte() & 1) ? 0xEE9E : 0xEEA1);
+				break;
+			default:
+				emit(program, 0xC000 | (x << 8) | random.nextByte());
+				break;
+		}
+	}
+
+	// Roughly the shape of a typical game's instruction stream
+	void typicalFragment(Xorshift32& random, Program& program) {
+		unsigned pick = random.nextByte() % 10;
+		if (pick < 4) {
+			aluFragment(random, program);
+		}
+		else if (pick < 6) {
+			branchFragment(random, program);
+		}
+		else if (pick < 8) {
+			memoryFragment(random, program);
+		}
+		else if (pick < 9) {
+			graphicsFragment(random, program);
+		}
+		else {
+			systemFragment(random, program);
+		}
+	}
+
+	typedef void (*Fragment)(Xorshift32& random, Program& program);
+
+	Program mix(Fragment fragment, uint32_t seed) {
+		Xorshift32 random;
+		random.seed(seed);
+
+		Program program;
+		program.keys = 0x00FF;
+		emit(program, 0xAE00);
+		emit(program, 0x6E00);
+
+		uint16_t loop = address(program);
+		while (program.rom.size() < 2 * MIX_LENGTH) {
+			fragment(random, program);
+		}
+		// Twice, in case the last instruction skips the first
+		emit(program, 0x1000 | loop);
+		emit(program, 0x1000 | loop);
+
+		program.rom.resize(SUBROUTINE_ADDRESS - ROM_START_ADDRESS, 0);
+		emit(program, 0x00EE);
+		return program;
+	}
+
+	struct MixBenchmark {
+		const char* name;
+		Fragment fragment;
+	};
+
+	const MixBenchmark MIX_BENCHMARKS[] = {
+		{ "alu", aluFragment },
+		{ "branch", branchFragment },
+		{ "memory", memoryFragment },
+		{ "graphics", graphicsFragment },
+		{ "system", systemFragment },
+		{ "typical", typicalFragment },
+	};
+
+	const Engine ALL_ENGINES[] = { Engine::CYCLE, Engine::BATCH, Engine::JIT };
+
+	// Chip8Batch lanes per run, and how many of them are replayed on Chip8 to check
+	const unsigned LANES = 64;
+	const unsigned CHECKED_LANES = 4;
+
+	void run(Engine engine, Chip8& chip8, Chip8Jit* jit, unsigned long long count) {
+		while (count > 0) {
+			unsigned chunk = static_cast<unsigned>(std::min<unsigned long long>(count, 1u << 20));
+			switch (engine) {
+				case Engine::CYCLE:
+					for (unsigned i = 0; i < chunk; i++) {
+						chip8.cycle();
+					}
+					break;
+				case Engine::BATCH:
+					chip8.runBatch(chunk);
+					break;
+				case Engine::JIT:
+					jit->run(chunk);
+					break;
+			}
+			count -= chunk;
+		}
+	}
+
+	// A benchmark that wrote over its own code or overflowed the stack is no longer
+	// running the instructions it claims to measure
+	bool intact(const Chip8& chip8, const Program& program) {
+		return std::equal(program.rom.begin(), program.rom.end(), chip8.memory + ROM_START_ADDRESS)
+			&& chip8.stackPointer <= sizeof(chip8.stack) / sizeof(chip8.stack[0]);
+	}
+
+	BenchmarkResult measure(const std::string& name, const char* kind, const Program& program, Engine engine, const BenchmarkOptions& options) {
+		Chip8 chip8;
+		chip8.randomGen.seed(1);
+		chip8.load_rom(program.rom.data(), program.rom.size());
+		chip8.keys = program.keys;
+		// Heap allocated, the JIT block cache is too big for the stack
+		std::unique_ptr<Chip8Jit> jit(engine == Engine::JIT ? new Chip8Jit(chip8) : nullptr);
+
+		// Fill the decode cache and compile JIT blocks before timing
+		run(engine, chip8, jit.get(), options.instructions / 10 + 1);
+		bool valid = intact(chip8, program);
+
+		double best = std::numeric_limits<double>::infinity();
+		for (unsigned i = 0; i < options.repetitions && valid; i++) {
+			auto start = std::chrono::steady_clock::now();
+			run(engine, chip8, jit.get(), options.instructions);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			best = std::min(best, seconds);
+			valid = intact(chip8, program);
+		}
+
+		BenchmarkResult result;
+		result.name = name;
+		result.kind = kind;
+		result.engine = engineName(engine);
+		result.instructions = options.instructions;
+		result.valid = valid;
+		result.nsPerInstruction = best * 1e9 / options.instructions;
+		result.instructionsPerSec = best > 0 ? options.instructions / best : 0;
+		return result;
+	}
+
+	// Whether a Chip8 seeded like the lane ends up in the same state after the
+	// same number of instructions
+	bool matchesChip8(const Chip8Batch& batch, unsigned lane, const Program& program, unsigned long long steps) {
+		Chip8 chip8;
+		chip8.randomGen.seed(lane + 1);
+		chip8.load_rom(program.rom.data(), program.rom.size());
+		chip8.keys = program.keys;
+		for (unsigned long long i = 0; i < steps; i++) {
+			chip8.cycle();
+		}
+
+		bool same = chip8.programCounter == batch.programCounter[lane] && chip8.index == batch.index[lane]
+			&& chip8.stackPointer == batch.stackPointer[lane] && chip8.hashVideo() == batch.hashVideo(lane);
+		for (unsigned i = 0; i < 16; i++) {
+			same = same && chip8.registers[i] == batch.registers[i][lane];
+		}
+		for (unsigned address = 0; address < MEMORY_SIZE; address++) {
+			same = same && chip8.memory[address] == batch.readByte(lane, static_cast<uint16_t>(address));
+		}
+		return same;
+	}
+
+	// Runs the program on LANES lanes in lockstep; instructions counts lane-instructions
+	BenchmarkResult measureLanes(const std::string& name, const char* kind, const Program& program, const BenchmarkOptions& options) {
+		Chip8Batch batch(LANES);
+		batch.load_rom(program.rom.data(), program.rom.size());
+		std::fill(batch.keys.begin(), batch.keys.end(), program.keys);
+
+		unsigned long long steps = options.instructions / LANES + 1;
+		// Warm up like measure() does
+		unsigned long long stepsRun = steps / 10 + 1;
+		for (unsigned long long i = 0; i < stepsRun; i++) {
+			batch.step();
+		}
+
+		double best = std::numeric_limits<double>::infinity();
+		for (unsigned i = 0; i < options.repetitions; i++) {
+			auto start = std::chrono::steady_clock::now();
+			for (unsigned long long step = 0; step < steps; step++) {
+				batch.step();
+			}
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			best = std::min(best, seconds);
+			stepsRun += steps;
+		}
+
+		bool valid = true;
+		for (unsigned i = 0; i < CHECKED_LANES; i++) {
+			valid = valid && matchesChip8(batch, i * (LANES - 1) / (CHECKED_LANES - 1), program, stepsRun);
+		}
+
+		BenchmarkResult result;
+		result.name = name;
+		result.kind = kind;
+		result.engine = "lanes";
+		result.instructions = steps * LANES;
+		result.valid = valid;
+		result.nsPerInstruction = best * 1e9 / result.instructions;
+		result.instructionsPerSec = best > 0 ? result.instructions / best : 0;
+		return result;
+	}
+
+	bool selected(const std::string& name, const BenchmarkOptions& options) {
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	}
+}
+
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkOptions& options) {
+	std::vector<BenchmarkResult> results;
+
+	for (const OpcodeBenchmark& benchmark : opcodeBenchmarks()) {
+		std::string name = std::string("opcode/") + benchmark.name;
+		if (selected(name, options)) {
+			results.push_back(measure(name, "opcode", benchmark.program, Engine::CYCLE, options));
+		}
+	}
+
+	uint32_t seed = 1;
+	for (const MixBenchmark& benchmark : MIX_BENCHMARKS) {
+		std::string name = std::string("mix/") + benchmark.name;
+		Program program = mix(benchmark.fragment, seed++);
+		for (Engine engine : ALL_ENGINES) {
+			if (selected(name, options)) {
+				results.push_back(measure(name, "mix", program, engine, options));
+			}
+		}
+		if (selected(name, options)) {
+			results.push_back(measureLanes(name, "mix", program, options));
+		}
+	}
+
+	for (size_t i = 0; i < BENCHMARK_ROM_COUNT; i++) {
+		std::string name = std::string("rom/") + BENCHMARK_ROMS[i].name;
+		Program program;
+		program.rom.assign(BENCHMARK_ROMS[i].data, BENCHMARK_ROMS[i].data + BENCHMARK_ROMS[i].size);
+		for (Engine engine : ALL_ENGINES) {
+			if (selected(name, options)) {
+				results.push_back(measure(name, "rom", program, engine, options));
+			}
+		}
+		if (selected(name, options)) {
+			results.push_back(measureLanes(name, "rom", program, options));
+		}
+	}
+
+	return results;
+}
+
+void writeBenchmarkJson(const std::vector<BenchmarkResult>& results, const BenchmarkOptions& options, std::ostream& out) {
+	out << "{\n";
+	out << "  \"instructions_per_run\": " << options.instructions << ",\n";
+	out << "  \"repetitions\": " << options.repetitions << ",\n";
+	out << "  \"benchmarks\": [";
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& result = results[i];
+		char numbers[128];
+		std::snprintf(numbers, sizeof(numbers), "\"ns_per_instruction\": %.4f, \"instructions_per_sec\": %.0f",
+			result.nsPerInstruction, result.instructionsPerSec);
+
+		out << (i ? ",\n" : "\n");
+		out << "    {\"name\": \"" << result.name << "\", \"kind\": \"" << result.kind << "\", \"engine\": \"" << result.engine
+			<< "\", \"instructions\": " << result.instructions << ", " << numbers
+			<< ", \"valid\": " << (result.valid ? "true" : "false") << "}";
+	}
+
+	out << "\n  ]\n}\n";
+}
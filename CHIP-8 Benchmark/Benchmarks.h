@@ -0,0 +1,27 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions {
+	// Instructions per timed run; each benchmark keeps its fastest of repetitions runs
+	unsigned long long instructions = 2000000;
+	unsigned repetitions = 5;
+	// Only benchmarks whose name contains this run
+	std::string filter;
+};
+
+struct BenchmarkResult {
+	std::string name;
+	std::string kind;
+	std::string engine;
+	unsigned long long instructions = 0;
+	// False if the program overwrote its own code or overflowed the stack, or
+	// Chip8Batch lanes ended up in a different state than Chip8
+	bool valid = true;
+	double nsPerInstruction = 0;
+	double instructionsPerSec = 0;
+};
+
+std::vector<BenchmarkResult> runBenchmarks(const BenchmarkOptions& options);
+void writeBenchmarkJson(const std::vector<BenchmarkResult>& results, const BenchmarkOptions& options, std::ostream& out);
@@ -0,0 +1,80 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Benchmarks.h"
+
+// Times the interpreter per opcode, on synthetic instruction mixes and on bundled
+// ROMs, and writes the results as JSON for tracking between revisions.
+
+static void printUsage() {
+	std::cout <<
+		"Usage: chip8-benchmark [options]\n"
+		"  --instructions N   instructions per timed run (default 2000000)\n"
+		"  --repetitions N    timed runs per benchmark, the fastest is kept (default 5)\n"
+		"  --filter TEXT      only run benchmarks whose name contains TEXT\n"
+		"  --output FILE      write the JSON results to FILE instead of stdout\n";
+}
+
+int main(int argc, char* argv[]) {
+	BenchmarkOptions options;
+	const char* outputFilename = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (option == "--instructions") {
+			options.instructions = std::strtoull(value, nullptr, 10);
+		}
+		else if (option == "--repetitions") {
+			options.repetitions = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+		}
+		else if (option == "--filter") {
+			options.filter = value;
+		}
+		else if (option == "--output") {
+			outputFilename = value;
+		}
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (options.instructions == 0 || options.repetitions == 0) {
+		std::cerr << "--instructions and --repetitions must be at least 1" << std::endl;
+		return 1;
+	}
+
+	std::vector<BenchmarkResult> results = runBenchmarks(options);
+
+	// A readable summary on stderr, so stdout stays valid JSON
+	bool allValid = true;
+	for (const BenchmarkResult& result : results) {
+		std::fprintf(stderr, "%-20s %-6s %8.3f ns/instruction %14.0f instructions/s%s\n",
+			result.name.c_str(), result.engine.c_str(), result.nsPerInstruction, result.instructionsPerSec,
+			result.valid ? "" : "  INVALID: corrupted, or lanes disagree with Chip8");
+		allValid = allValid && result.valid;
+	}
+
+	if (outputFilename) {
+		std::ofstream output(outputFilename);
+		if (!output.is_open()) {
+			std::cerr << "Failed to open " << outputFilename << std::endl;
+			return 1;
+		}
+		writeBenchmarkJson(results, options, output);
+	}
+	else {
+		writeBenchmarkJson(results, options, std::cout);
+	}
+
+	return allValid ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "Audio.h"
+#include <algorithm>
+#include <iostream>
+
+#include "Chip8.h"
+
+namespace {
+	const int REQUESTED_SAMPLE_RATE = 48000;
+	const Uint16 DEVICE_BUFFER_SAMPLES = 512;
+
+	// About 85 ms at 48 kHz, the ring runs at half of this
+	const size_t RING_SAMPLES = 4096;
+
+	const double BEEP_FREQUENCY = 440.0;
+	const float BEEP_AMPLITUDE = 0.2f * 32767;
+
+	// Largest change to the samples made per frame, as a fraction. At 0.5% the
+	// pitch shift is inaudible but covers far more drift than real clocks have.
+	const double MAX_RATE_ADJUST = 0.005;
+
+	// Per-sample steps of the beeper's envelope, so it starts and stops without
+	// clicks: about 1 ms to open and close, and a slower fade on underrun
+	const float ENVELOPE_STEP = 1.0f / 48;
+	const float UNDERRUN_DECAY = 0.995f;
+}
+
+Audio::Audio()
+	: device(0), sampleRate(REQUESTED_SAMPLE_RATE), ring(RING_SAMPLES), phase(0), pendingSamples(0), level(0), lastSample(0) {
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+		std::cerr << "Audio disabled: " << SDL_GetError() << std::endl;
+		return;
+	}
+
+	SDL_AudioSpec desired = {};
+	desired.freq = REQUESTED_SAMPLE_RATE;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 1;
+	desired.samples = DEVICE_BUFFER_SAMPLES;
+	desired.callback = &Audio::fill;
+	desired.userdata = this;
+
+	SDL_AudioSpec obtained;
+	device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (device == 0) {
+		std::cerr << "Audio disabled: " << SDL_GetError() << std::endl;
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return;
+	}
+
+	sampleRate = obtained.freq;
+	frame.resize(sampleRate / FRAME_RATE * 2);
+
+	// Start half full of silence so the first frames have room either way
+	std::vector<int16_t> silence(ring.capacity() / 2, 0);
+	ring.write(silence.data(), silence.size());
+	SDL_PauseAudioDevice(device, 0);
+}
+
+Audio::~Audio() {
+	if (device != 0) {
+		SDL_CloseAudioDevice(device);
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+	}
+}
+
+bool Audio::isOpen() const {
+	return device != 0;
+}
+
+// Called on the emulation thread after every frame with whether the sound timer
+// was running. Never blocks; samples that don't fit are dropped.
+void Audio::pushFrame(bool beeping) {
+	if (device == 0) {
+		return;
+	}
+
+	// Produce more samples while the ring is below half full and fewer above it
+	double fill = static_cast<double>(ring.size()) / ring.capacity();
+	double rate = 1.0 + MAX_RATE_ADJUST * (1.0 - 2.0 * fill);
+
+	pendingSamples += rate * sampleRate / FRAME_RATE;
+	size_t count = static_cast<size_t>(pendingSamples);
+	pendingSamples -= count;
+	if (count > frame.size()) {
+		count = frame.size();
+	}
+
+	// Keep the pitch where it is however many samples this frame gets
+	double step = BEEP_FREQUENCY / (sampleRate * rate);
+	float target = beeping ? 1.0f : 0.0f;
+	for (size_t i = 0; i < count; i++) {
+		if (level < target) {
+			level = std::min(level + ENVELOPE_STEP, target);
+		}
+		else if (level > target) {
+			level = std::max(level - ENVELOPE_STEP, target);
+		}
+
+		float square = phase < 0.5 ? BEEP_AMPLITUDE : -BEEP_AMPLITUDE;
+		frame[i] = static_cast<int16_t>(square * level);
+		phase += step;
+		if (phase >= 1.0) {
+			phase -= 1.0;
+		}
+	}
+
+	ring.write(frame.data(), count);
+}
+
+// SDL's audio thread. A short read means the emulation thread fell behind, so the
+// rest of the buffer decays from the last sample instead of cutting off.
+void SDLCALL Audio::fill(void* userdata, Uint8* stream, int length) {
+	Audio& audio = *static_cast<Audio*>(userdata);
+	int16_t* samples = reinterpret_cast<int16_t*>(stream);
+	size_t count = length / sizeof(int16_t);
+
+	size_t read = audio.ring.read(samples, count);
+	if (read > 0) {
+		audio.lastSample = samples[read - 1];
+	}
+	for (size_t i = read; i < count; i++) {
+		audio.lastSample = static_cast<int16_t>(audio.lastSample * UNDERRUN_DECAY);
+		samples[i] = audio.lastSample;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "SDL.h"
+
+#include "SampleRing.h"
+
+// The CHIP-8 beeper: a square wave while the sound timer runs. The emulation
+// thread synthesizes each frame's samples into a lock-free ring that the SDL
+// audio callback drains. The ring is kept half full by nudging how many samples a
+// frame produces (dynamic rate control), so the emulation and audio clocks never
+// drift far enough apart to underrun or overflow.
+class Audio {
+public:
+	Audio();
+	~Audio();
+
+	bool isOpen() const;
+	void pushFrame(bool beeping);
+private:
+	static void SDLCALL fill(void* userdata, Uint8* stream, int length);
+
+	SDL_AudioDeviceID device;
+	int sampleRate;
+	SampleRing ring;
+	std::vector<int16_t> frame;
+
+	// Producer state
+	double phase;
+	double pendingSamples;
+	float level;
+
+	// Consumer state, for fading out instead of clicking when the ring runs dry
+	int16_t lastSample;
+};
@@ -1,106 +1,605 @@
 #include "Chip8.h"
-#include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <type_traits>
 
-Chip8::Chip8() 
-	: randomGen(std::chrono::system_clock::now().time_since_epoch().count()) {
-	randomByte = std::uniform_int_distribution<int>(0, 255);
+const uint8_t FONTSET[FONTSET_SIZE] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+const Chip8::Handler Chip8::handlers[] = {
+	&Chip8::OP_NULL, // DECODE, never dispatched
+	&Chip8::OP_NULL,
+	&Chip8::OP_00E0,
+	&Chip8::OP_00EE,
+	&Chip8::OP_1nnn,
+	&Chip8::OP_2nnn,
+	&Chip8::OP_3xkk,
+	&Chip8::OP_4xkk,
+	&Chip8::OP_5xy0,
+	&Chip8::OP_6xkk,
+	&Chip8::OP_7xkk,
+	&Chip8::OP_8xy0,
+	&Chip8::OP_8xy1,
+	&Chip8::OP_8xy2,
+	&Chip8::OP_8xy3,
+	&Chip8::OP_8xy4,
+	&Chip8::OP_8xy5,
+	&Chip8::OP_8xy6,
+	&Chip8::OP_8xy7,
+	&Chip8::OP_8xyE,
+	&Chip8::OP_9xy0,
+	&Chip8::OP_Annn,
+	&Chip8::OP_Bnnn,
+	&Chip8::OP_Cxkk,
+	&Chip8::OP_Dxyn,
+	&Chip8::OP_Ex9E,
+	&Chip8::OP_ExA1,
+	&Chip8::OP_Fx07,
+	&Chip8::OP_Fx0A,
+	&Chip8::OP_Fx15,
+	&Chip8::OP_Fx18,
+	&Chip8::OP_Fx1E,
+	&Chip8::OP_Fx29,
+	&Chip8::OP_Fx33,
+	&Chip8::OP_Fx55,
+	&Chip8::OP_Fx65,
+};
+
+Chip8::Chip8() : decodeCache(new Instruction[MEMORY_SIZE]()) {
+	randomGen.seed(static_cast<uint32_t>(std::chrono::system_clock::now().time_since_epoch().count()));
 	programCounter = ROM_START_ADDRESS;
+
+	// Start from a blank machine so runs are reproducible
+	opcode = 0;
+	index = 0;
+	stackPointer = 0;
+	delayTimer = 0;
+	soundTimer = 0;
+	std::fill(registers, registers + 16, 0);
+	std::fill(stack, stack + 16, 0);
+	std::fill(memory, memory + MEMORY_SIZE, 0);
+	std::fill(video, video + VIDEO_HEIGHT, 0);
+	keys = 0;
+
+	// Every frontend starts from the same memory image, so movies and save
+	// states carry over between them
+	load_fonts();
 }
 
 void Chip8::cycle() {
-	opcode = (memory[programCounter] << 8) | memory[programCounter + 1];
+	Instruction& instruction = fetch();
+	(this->*handlers[static_cast<int>(instruction.op)])(instruction);
+}
+
+// Runs one 60 Hz frame: cyclesPerFrame instructions, then a single timer tick
+void Chip8::runFrame() {
+	runBatch(cyclesPerFrame);
+	tickTimers();
+}
+
+// Executes count instructions in one call, with the same result as calling cycle()
+// count times. With GCC/Clang each handler jumps straight to the next one through
+// a label table (direct threading); other compilers fall back to a switch loop.
+// A superinstruction runs as its first instruction alone when fewer instructions
+// than its length are left of count.
+//
+// Keys and timers only change between batches, so a batch that reaches a wait on
+// either can't leave it: Fx0A without a key pressed, or a loop polling the delay
+// timer. The rest of the batch is then skipped and counted in idleInstructions.
+void Chip8::runBatch(unsigned count) {
+	if (count == 0) {
+		return;
+	}
+
+#if defined(__GNUC__)
+	static void* const labels[] = {
+		&&DECODE,
+		&&NOP,
+		&&OP_00E0,
+		&&OP_00EE,
+		&&OP_1nnn,
+		&&OP_2nnn,
+		&&OP_3xkk,
+		&&OP_4xkk,
+		&&OP_5xy0,
+		&&OP_6xkk,
+		&&OP_7xkk,
+		&&OP_8xy0,
+		&&OP_8xy1,
+		&&OP_8xy2,
+		&&OP_8xy3,
+		&&OP_8xy4,
+		&&OP_8xy5,
+		&&OP_8xy6,
+		&&OP_8xy7,
+		&&OP_8xyE,
+		&&OP_9xy0,
+		&&OP_Annn,
+		&&OP_Bnnn,
+		&&OP_Cxkk,
+		&&OP_Dxyn,
+		&&OP_Ex9E,
+		&&OP_ExA1,
+		&&OP_Fx07,
+		&&OP_Fx0A,
+		&&OP_Fx15,
+		&&OP_Fx18,
+		&&OP_Fx1E,
+		&&OP_Fx29,
+		&&OP_Fx33,
+		&&OP_Fx55,
+		&&OP_Fx65,
+		&&FUSED_Annn_Dxyn,
+		&&FUSED_6xkk_6xkk,
+		&&FUSED_3xkk_1nnn,
+		&&FUSED_4xkk_1nnn,
+		&&FUSED_Fx07_3xkk_1nnn,
+	};
+	static_assert(sizeof(labels) / sizeof(labels[0]) == static_cast<int>(Op::COUNT) + static_cast<int>(Fused::COUNT),
+		"label table out of sync with Op and Fused");
+
+	Instruction* instruction;
+
+#define DISPATCH() \
+	goto *labels[instruction->dispatch]
+
+#define NEXT() \
+	if (--count == 0) { \
+		return; \
+	} \
+	instruction = &fetch(); \
+	DISPATCH()
+
+	instruction = &fetch();
+	DISPATCH();
+
+DECODE:
+NOP:
+	NEXT();
+OP_00E0:
+	OP_00E0(*instruction);
+	NEXT();
+OP_00EE:
+	OP_00EE(*instruction);
+	NEXT();
+OP_1nnn:
+	OP_1nnn(*instruction);
+	// A jump to itself halts the program for good
+	if (&decodeCache[programCounter & 0x0FFF] == instruction) {
+		idleInstructions += count - 1;
+		return;
+	}
+	NEXT();
+OP_2nnn:
+	OP_2nnn(*instruction);
+	NEXT();
+OP_3xkk:
+	OP_3xkk(*instruction);
+	NEXT();
+OP_4xkk:
+	OP_4xkk(*instruction);
+	NEXT();
+OP_5xy0:
+	OP_5xy0(*instruction);
+	NEXT();
+OP_6xkk:
+	OP_6xkk(*instruction);
+	NEXT();
+OP_7xkk:
+	OP_7xkk(*instruction);
+	NEXT();
+OP_8xy0:
+	OP_8xy0(*instruction);
+	NEXT();
+OP_8xy1:
+	OP_8xy1(*instruction);
+	NEXT();
+OP_8xy2:
+	OP_8xy2(*instruction);
+	NEXT();
+OP_8xy3:
+	OP_8xy3(*instruction);
+	NEXT();
+OP_8xy4:
+	OP_8xy4(*instruction);
+	NEXT();
+OP_8xy5:
+	OP_8xy5(*instruction);
+	NEXT();
+OP_8xy6:
+	OP_8xy6(*instruction);
+	NEXT();
+OP_8xy7:
+	OP_8xy7(*instruction);
+	NEXT();
+OP_8xyE:
+	OP_8xyE(*instruction);
+	NEXT();
+OP_9xy0:
+	OP_9xy0(*instruction);
+	NEXT();
+OP_Annn:
+	OP_Annn(*instruction);
+	NEXT();
+OP_Bnnn:
+	OP_Bnnn(*instruction);
+	NEXT();
+OP_Cxkk:
+	OP_Cxkk(*instruction);
+	NEXT();
+OP_Dxyn:
+	OP_Dxyn(*instruction);
+	NEXT();
+OP_Ex9E:
+	OP_Ex9E(*instruction);
+	NEXT();
+OP_ExA1:
+	OP_ExA1(*instruction);
+	NEXT();
+OP_Fx07:
+	OP_Fx07(*instruction);
+	NEXT();
+OP_Fx0A:
+	OP_Fx0A(*instruction);
+	if (&decodeCache[programCounter & 0x0FFF] == instruction) {
+		idleInstructions += count - 1;
+		return;
+	}
+	NEXT();
+OP_Fx15:
+	OP_Fx15(*instruction);
+	NEXT();
+OP_Fx18:
+	OP_Fx18(*instruction);
+	NEXT();
+OP_Fx1E:
+	OP_Fx1E(*instruction);
+	NEXT();
+OP_Fx29:
+	OP_Fx29(*instruction);
+	NEXT();
+OP_Fx33:
+	OP_Fx33(*instruction);
+	NEXT();
+OP_Fx55:
+	OP_Fx55(*instruction);
+	NEXT();
+OP_Fx65:
+	OP_Fx65(*instruction);
+	NEXT();
+FUSED_Annn_Dxyn:
+	if (count < 2) {
+		goto OP_Annn;
+	}
+	count -= FUSED_Annn_Dxyn(*instruction) - 1;
+	NEXT();
+FUSED_6xkk_6xkk:
+	if (count < 2) {
+		goto OP_6xkk;
+	}
+	count -= FUSED_6xkk_6xkk(*instruction) - 1;
+	NEXT();
+FUSED_3xkk_1nnn:
+	if (count < 2) {
+		goto OP_3xkk;
+	}
+	count -= FUSED_3xkk_1nnn(*instruction) - 1;
+	NEXT();
+FUSED_4xkk_1nnn:
+	if (count < 2) {
+		goto OP_4xkk;
+	}
+	count -= FUSED_4xkk_1nnn(*instruction) - 1;
+	NEXT();
+FUSED_Fx07_3xkk_1nnn:
+	if (count < 3) {
+		goto OP_Fx07;
+	}
+	count -= FUSED_Fx07_3xkk_1nnn(*instruction, count) - 1;
+	NEXT();
+
+#undef NEXT
+#undef DISPATCH
+#else
+	const int FUSED = static_cast<int>(Op::COUNT);
+
+	while (count > 0) {
+		Instruction& instruction = fetch();
+		unsigned executed = 1;
+		switch (instruction.dispatch) {
+			case FUSED + static_cast<int>(Fused::FUSED_Annn_Dxyn):
+				if (count < 2) {
+					OP_Annn(instruction);
+					break;
+				}
+				executed = FUSED_Annn_Dxyn(instruction);
+				break;
+			case FUSED + static_cast<int>(Fused::FUSED_6xkk_6xkk):
+				if (count < 2) {
+					OP_6xkk(instruction);
+					break;
+				}
+				executed = FUSED_6xkk_6xkk(instruction);
+				break;
+			case FUSED + static_cast<int>(Fused::FUSED_3xkk_1nnn):
+				if (count < 2) {
+					OP_3xkk(instruction);
+					break;
+				}
+				executed = FUSED_3xkk_1nnn(instruction);
+				break;
+			case FUSED + static_cast<int>(Fused::FUSED_4xkk_1nnn):
+				if (count < 2) {
+					OP_4xkk(instruction);
+					break;
+				}
+				executed = FUSED_4xkk_1nnn(instruction);
+				break;
+			case FUSED + static_cast<int>(Fused::FUSED_Fx07_3xkk_1nnn):
+				if (count < 3) {
+					OP_Fx07(instruction);
+					break;
+				}
+				executed = FUSED_Fx07_3xkk_1nnn(instruction, count);
+				break;
+			case static_cast<int>(Op::OP_00E0):
+				OP_00E0(instruction);
+				break;
+			case static_cast<int>(Op::OP_00EE):
+				OP_00EE(instruction);
+				break;
+			case static_cast<int>(Op::OP_1nnn):
+				OP_1nnn(instruction);
+				// A jump to itself halts the program for good
+				if (&decodeCache[programCounter & 0x0FFF] == &instruction) {
+					idleInstructions += count - 1;
+					return;
+				}
+				break;
+			case static_cast<int>(Op::OP_2nnn):
+				OP_2nnn(instruction);
+				break;
+			case static_cast<int>(Op::OP_3xkk):
+				OP_3xkk(instruction);
+				break;
+			case static_cast<int>(Op::OP_4xkk):
+				OP_4xkk(instruction);
+				break;
+			case static_cast<int>(Op::OP_5xy0):
+				OP_5xy0(instruction);
+				break;
+			case static_cast<int>(Op::OP_6xkk):
+				OP_6xkk(instruction);
+				break;
+			case static_cast<int>(Op::OP_7xkk):
+				OP_7xkk(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy0):
+				OP_8xy0(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy1):
+				OP_8xy1(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy2):
+				OP_8xy2(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy3):
+				OP_8xy3(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy4):
+				OP_8xy4(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy5):
+				OP_8xy5(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy6):
+				OP_8xy6(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xy7):
+				OP_8xy7(instruction);
+				break;
+			case static_cast<int>(Op::OP_8xyE):
+				OP_8xyE(instruction);
+				break;
+			case static_cast<int>(Op::OP_9xy0):
+				OP_9xy0(instruction);
+				break;
+			case static_cast<int>(Op::OP_Annn):
+				OP_Annn(instruction);
+				break;
+			case static_cast<int>(Op::OP_Bnnn):
+				OP_Bnnn(instruction);
+				break;
+			case static_cast<int>(Op::OP_Cxkk):
+				OP_Cxkk(instruction);
+				break;
+			case static_cast<int>(Op::OP_Dxyn):
+				OP_Dxyn(instruction);
+				break;
+			case static_cast<int>(Op::OP_Ex9E):
+				OP_Ex9E(instruction);
+				break;
+			case static_cast<int>(Op::OP_ExA1):
+				OP_ExA1(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx07):
+				OP_Fx07(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx0A):
+				OP_Fx0A(instruction);
+				if (&decodeCache[programCounter & 0x0FFF] == &instruction) {
+					idleInstructions += count - 1;
+					return;
+				}
+				break;
+			case static_cast<int>(Op::OP_Fx15):
+				OP_Fx15(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx18):
+				OP_Fx18(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx1E):
+				OP_Fx1E(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx29):
+				OP_Fx29(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx33):
+				OP_Fx33(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx55):
+				OP_Fx55(instruction);
+				break;
+			case static_cast<int>(Op::OP_Fx65):
+				OP_Fx65(instruction);
+				break;
+			default:
+				break;
+		}
+		count -= executed;
+	}
+#endif
+}
+
+// Returns the decoded instruction at the program counter and steps past it
+inline Instruction& Chip8::fetch() {
+	Instruction& instruction = decodeCache[programCounter & 0x0FFF];
+	if (instruction.length == 0) {
+		prepare(programCounter);
+	}
+
+	opcode = instruction.opcode;
 	programCounter += 2;
+	return instruction;
+}
+
+// Called once per frame, the timers count down at 60 Hz
+void Chip8::tickTimers() {
+	if (delayTimer > 0) {
+		delayTimer--;
+	}
+	if (soundTimer > 0) {
+		soundTimer--;
+	}
+}
+
+// Unpacks the operand fields of an opcode and picks the handler that executes it.
+// Unknown opcodes decode to NOP.
+Instruction Chip8::decode(uint16_t opcode) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	instruction.nnn = opcode & 0x0FFF;
+	instruction.x = (opcode & 0x0F00) >> 8;
+	instruction.y = (opcode & 0x00F0) >> 4;
+	instruction.n = opcode & 0x000F;
+	instruction.kk = opcode & 0x00FF;
+	instruction.op = Op::NOP;
 
 	switch (opcode & 0xF000) {
 		case 0x0000:
 			switch (opcode & 0x00FF) {
 				case 0x00E0:
-					OP_00E0();
+					instruction.op = Op::OP_00E0;
 					break;
 				case 0x00EE:
-					OP_00EE();
+					instruction.op = Op::OP_00EE;
 					break;
 				default:
 					break;
 			}
 			break;
 		case 0x1000:
-			OP_1nnn();
+			instruction.op = Op::OP_1nnn;
 			break;
 		case 0x2000:
-			OP_2nnn();
+			instruction.op = Op::OP_2nnn;
 			break;
 		case 0x3000:
-			OP_3xkk();
+			instruction.op = Op::OP_3xkk;
 			break;
 		case 0x4000:
-			OP_4xkk();
+			instruction.op = Op::OP_4xkk;
 			break;
 		case 0x5000:
-			OP_5xy0();
+			instruction.op = Op::OP_5xy0;
 			break;
 		case 0x6000:
-			OP_6xkk();
+			instruction.op = Op::OP_6xkk;
 			break;
 		case 0x7000:
-			OP_7xkk();
+			instruction.op = Op::OP_7xkk;
 			break;
 		case 0x8000:
 			switch (opcode & 0x000F) {
 				case 0x0:
-					OP_8xy0();
+					instruction.op = Op::OP_8xy0;
 					break;
 				case 0x1:
-					OP_8xy1();
+					instruction.op = Op::OP_8xy1;
 					break;
 				case 0x2:
-					OP_8xy2();
+					instruction.op = Op::OP_8xy2;
 					break;
 				case 0x3:
-					OP_8xy3();
+					instruction.op = Op::OP_8xy3;
 					break;
 				case 0x4:
-					OP_8xy4();
+					instruction.op = Op::OP_8xy4;
 					break;
 				case 0x5:
-					OP_8xy5();
+					instruction.op = Op::OP_8xy5;
 					break;
 				case 0x6:
-					OP_8xy6();
+					instruction.op = Op::OP_8xy6;
 					break;
 				case 0x7:
-					OP_8xy7();
+					instruction.op = Op::OP_8xy7;
 					break;
 				case 0xE:
-					OP_8xyE();
+					instruction.op = Op::OP_8xyE;
 					break;
 				default:
 					break;
 			}
+			break;
 		case 0x9000:
-			OP_9xy0();
+			instruction.op = Op::OP_9xy0;
 			break;
 		case 0xA000:
-			OP_Annn();
+			instruction.op = Op::OP_Annn;
 			break;
 		case 0xB000:
-			OP_Bnnn();
+			instruction.op = Op::OP_Bnnn;
 			break;
 		case 0xC000:
-			OP_Cxkk();
+			instruction.op = Op::OP_Cxkk;
 			break;
 		case 0xD000:
-			OP_Dxyn();
+			instruction.op = Op::OP_Dxyn;
 			break;
 		case 0xE000:
 			switch (opcode & 0x00FF) {
 				case 0x9E:
-					OP_Ex9E();
+					instruction.op = Op::OP_Ex9E;
 					break;
 				case 0xA1:
-					OP_ExA1();
+					instruction.op = Op::OP_ExA1;
 					break;
 				default:
 					break;
@@ -109,31 +608,31 @@ void Chip8::cycle() {
 		case 0xF000:
 			switch (opcode & 0x00FF) {
 				case 0x07:
-					OP_Fx07();
+					instruction.op = Op::OP_Fx07;
 					break;
 				case 0x0A:
-					OP_Fx0A();
+					instruction.op = Op::OP_Fx0A;
 					break;
 				case 0x15:
-					OP_Fx15();
+					instruction.op = Op::OP_Fx15;
 					break;
 				case 0x18:
-					OP_Fx18();
+					instruction.op = Op::OP_Fx18;
 					break;
 				case 0x1E:
-					OP_Fx1E();
+					instruction.op = Op::OP_Fx1E;
 					break;
 				case 0x29:
-					OP_Fx29();
+					instruction.op = Op::OP_Fx29;
 					break;
 				case 0x33:
-					OP_Fx33();
+					instruction.op = Op::OP_Fx33;
 					break;
 				case 0x55:
-					OP_Fx55();
+					instruction.op = Op::OP_Fx55;
 					break;
 				case 0x65:
-					OP_Fx65();
+					instruction.op = Op::OP_Fx65;
 					break;
 				default:
 					break;
@@ -143,154 +642,392 @@ void Chip8::cycle() {
 			break;
 	}
 
-	if (delayTimer > 0) {
-		delayTimer--;
+	instruction.dispatch = static_cast<uint8_t>(instruction.op);
+	instruction.length = 0;
+	return instruction;
+}
+
+// Fills the cache entry at address, decoding it if needed, and checks whether it
+// starts a superinstruction. The instructions it would fuse with are decoded into
+// their own entries, which jumps or skips into the middle of the sequence still
+// use, so fusion never changes where execution can land.
+void Chip8::prepare(uint16_t address) {
+	Instruction& instruction = decodeCache[address & 0x0FFF];
+	if (instruction.op == Op::DECODE) {
+		instruction = decode(readOpcode(address));
 	}
-	if (soundTimer > 0) {
-		soundTimer--;
+
+	auto following = [this, address](unsigned offset) -> const Instruction& {
+		Instruction& next = decodeCache[(address + offset) & 0x0FFF];
+		if (next.op == Op::DECODE) {
+			next = decode(readOpcode(address + offset));
+		}
+		return next;
+	};
+
+	Fused fused = Fused::COUNT;
+	unsigned length = 1;
+	switch (instruction.op) {
+		case Op::OP_Annn:
+			if (following(2).op == Op::OP_Dxyn) {
+				fused = Fused::FUSED_Annn_Dxyn;
+				length = 2;
+			}
+			break;
+		case Op::OP_6xkk:
+			if (following(2).op == Op::OP_6xkk) {
+				fused = Fused::FUSED_6xkk_6xkk;
+				length = 2;
+			}
+			break;
+		case Op::OP_3xkk:
+			if (following(2).op == Op::OP_1nnn) {
+				fused = Fused::FUSED_3xkk_1nnn;
+				length = 2;
+			}
+			break;
+		case Op::OP_4xkk:
+			if (following(2).op == Op::OP_1nnn) {
+				fused = Fused::FUSED_4xkk_1nnn;
+				length = 2;
+			}
+			break;
+		case Op::OP_Fx07:
+			if (following(2).op == Op::OP_3xkk && following(4).op == Op::OP_1nnn) {
+				fused = Fused::FUSED_Fx07_3xkk_1nnn;
+				length = 3;
+			}
+			break;
+		default:
+			break;
+	}
+
+	instruction.dispatch = static_cast<uint8_t>(instruction.op);
+	if (fused != Fused::COUNT) {
+		instruction.dispatch = static_cast<uint8_t>(static_cast<int>(Op::COUNT) + static_cast<int>(fused));
+		fusedPages |= 1 << ((address & 0x0FFF) >> 8);
+	}
+	instruction.length = static_cast<uint8_t>(length);
+}
+
+// Drops the cached decode of every instruction that overlaps the byte at address,
+// and the fusion of any superinstruction that reaches it
+void Chip8::invalidate(uint16_t address) {
+	address &= 0x0FFF;
+	for (unsigned back = 0; back < 2; back++) {
+		Instruction& instruction = decodeCache[(address - back) & 0x0FFF];
+		instruction.op = Op::DECODE;
+		instruction.length = 0;
+	}
+
+	// Only pages holding superinstructions need the wider search
+	if (fusedPages & ((1 << (address >> 8)) | (1 << (((address - 5) & 0x0FFF) >> 8)))) {
+		for (unsigned back = 2; back < 6; back++) {
+			Instruction& instruction = decodeCache[(address - back) & 0x0FFF];
+			if (2u * instruction.length > back) {
+				instruction.length = 0;
+			}
+		}
+	}
+	writtenPages |= 1 << (address >> 8);
+}
+
+void Chip8::flushDecodeCache() {
+	for (unsigned address = 0; address < MEMORY_SIZE; address++) {
+		decodeCache[address].op = Op::DECODE;
+		decodeCache[address].length = 0;
 	}
+	writtenPages = 0xFFFF;
+	fusedPages = 0;
 }
 
-void Chip8::load_rom(const char* romName) {
+// Returns false if the ROM could not be opened. Prints nothing, so callers on
+// worker threads can report the failure their own way.
+bool Chip8::load_rom(const char* romName) {
 	std::ifstream romFile(romName, std::ios::binary | std::ios::ate);
 
 	if (!romFile.is_open()) {
-		std::cout << "Failed to open ROM file!" << std::endl;
-		return;
+		return false;
 	}
 
-	// Create a buffer to hold the ROM file temporary
-	std::streampos romSize = romFile.tellg();
-	char* buffer = new char[romSize];
+	// Read straight into memory, dropping anything that would run past the end
+	std::streamsize romSize = romFile.tellg();
+	romSize = std::min<std::streamsize>(romSize, MEMORY_SIZE - ROM_START_ADDRESS);
 
-	romFile.seekg(0, romSize);
-	romFile.read(buffer, romSize);
+	romFile.seekg(0, std::ios::beg);
+	romFile.read(reinterpret_cast<char*>(&memory[ROM_START_ADDRESS]), romSize);
 	romFile.close();
 
-	for (long x = 0; x < romSize; x++) {
-		memory[ROM_START_ADDRESS + x] = buffer[x];
-	}
-	
-	delete[] buffer;
-}	
+	flushDecodeCache();
+	return true;
+}
+
+// Copies a ROM image already in memory, dropping anything that would run past
+// the end
+void Chip8::load_rom(const uint8_t* rom, size_t romSize) {
+	romSize = std::min<size_t>(romSize, MEMORY_SIZE - ROM_START_ADDRESS);
+	std::memcpy(&memory[ROM_START_ADDRESS], rom, romSize);
+	flushDecodeCache();
+}
 
+// The constructor already does this; only needed to restore a font a ROM overwrote
 void Chip8::load_fonts() {
-	const unsigned int FONTSET_SIZE = 80;
-
-	uint8_t fontSet[FONTSET_SIZE] = {
-		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-		0x20, 0x60, 0x20, 0x20, 0x70, // 1
-		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+	std::memcpy(&memory[FONTSET_START_ADDRESS], FONTSET, FONTSET_SIZE);
+	flushDecodeCache();
+}
+
+// Save states are a header followed by the raw bytes of the machine state, opcode
+// through randomGen. They only load into a build with the same layout.
+namespace {
+	const uint32_t SAVE_STATE_MAGIC = 0x53533843; // "C8SS"
+	const uint16_t SAVE_STATE_VERSION = 3;
+
+	struct SaveStateHeader {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t reserved;
+		uint32_t machineSize;
 	};
 
-	for (int x = 0; x < FONTSET_SIZE; x++) {
-		memory[FONTSET_START_ADDRESS + x] = fontSet[x];
+	static_assert(std::is_trivially_copyable<Xorshift32>::value,
+		"saveState copies the random generator byte for byte");
+}
+
+// Offset of a saved field from the start of the block
+static size_t machineOffset(const Chip8& chip8, const void* field) {
+	return static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&chip8.opcode);
+}
+
+static size_t machineStateSize(const Chip8& chip8) {
+	return machineOffset(chip8, &chip8.randomGen + 1);
+}
+
+// Zeroes the padding between the saved fields, so identical machines give
+// identical blobs
+static void clearPadding(const Chip8& chip8, uint8_t* machine) {
+	struct Field {
+		const void* start;
+		size_t size;
+	};
+	const Field fields[] = {
+		{ &chip8.opcode, sizeof(chip8.opcode) },
+		{ &chip8.programCounter, sizeof(chip8.programCounter) },
+		{ &chip8.index, sizeof(chip8.index) },
+		{ &chip8.stackPointer, sizeof(chip8.stackPointer) },
+		{ &chip8.delayTimer, sizeof(chip8.delayTimer) },
+		{ &chip8.soundTimer, sizeof(chip8.soundTimer) },
+		{ chip8.registers, sizeof(chip8.registers) },
+		{ chip8.stack, sizeof(chip8.stack) },
+		{ chip8.memory, sizeof(chip8.memory) },
+		{ chip8.video, sizeof(chip8.video) },
+		{ &chip8.dirtyRows, sizeof(chip8.dirtyRows) },
+		{ &chip8.keys, sizeof(chip8.keys) },
+		{ &chip8.randomGen, sizeof(chip8.randomGen) },
+	};
+
+	size_t end = 0;
+	for (const Field& field : fields) {
+		size_t start = machineOffset(chip8, field.start);
+		std::memset(machine + end, 0, start - end);
+		end = start + field.size;
 	}
+}
 
+size_t Chip8::stateSize() const {
+	return sizeof(SaveStateHeader) + machineStateSize(*this);
+}
+
+// Returns the number of bytes written, or 0 if buffer is smaller than stateSize()
+size_t Chip8::saveState(uint8_t* buffer, size_t capacity) const {
+	if (capacity < stateSize()) {
+		return 0;
+	}
+
+	SaveStateHeader header = {};
+	header.magic = SAVE_STATE_MAGIC;
+	header.version = SAVE_STATE_VERSION;
+	header.machineSize = static_cast<uint32_t>(machineStateSize(*this));
+
+	std::memcpy(buffer, &header, sizeof(header));
+	std::memcpy(buffer + sizeof(header), &opcode, header.machineSize);
+	clearPadding(*this, buffer + sizeof(header));
+	return stateSize();
+}
+
+// Returns false, leaving the machine untouched, if the blob was not written by
+// saveState() of a compatible build or holds a state the machine can't be in: a
+// stack pointer past the stack, or a random generator stuck at zero. Only cached
+// decodes of memory that actually changed are dropped.
+bool Chip8::loadState(const uint8_t* buffer, size_t size) {
+	SaveStateHeader header;
+	if (size < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, buffer, sizeof(header));
+
+	if (header.magic != SAVE_STATE_MAGIC || header.version != SAVE_STATE_VERSION
+		|| header.machineSize != machineStateSize(*this) || size < stateSize()) {
+		return false;
+	}
+
+	const uint8_t* machine = buffer + sizeof(header);
+	Xorshift32 newRandomGen;
+	std::memcpy(&newRandomGen, machine + machineOffset(*this, &randomGen), sizeof(newRandomGen));
+	if (machine[machineOffset(*this, &stackPointer)] > 16 || newRandomGen.state == 0) {
+		return false;
+	}
+
+	const uint8_t* newMemory = machine + machineOffset(*this, memory);
+	for (unsigned address = 0; address < MEMORY_SIZE; address += 64) {
+		if (std::memcmp(&memory[address], &newMemory[address], 64) == 0) {
+			continue;
+		}
+		for (unsigned i = address; i < address + 64; i++) {
+			if (memory[i] != newMemory[i]) {
+				invalidate(i);
+			}
+		}
+	}
+
+	std::memcpy(&opcode, machine, header.machineSize);
+
+	// The frontend's copy of the display is stale
+	dirtyRows = 0xFFFFFFFF;
+	return true;
+}
+
+// Writes a display row out as one RGBA pixel per CHIP-8 pixel, 0xFFFFFFFF for on
+// and 0 for off
+void expandVideoRow(uint64_t bits, uint32_t* pixels) {
+	for (unsigned column = 0; column < VIDEO_WIDTH; column++) {
+		pixels[column] = 0u - static_cast<uint32_t>((bits >> (VIDEO_WIDTH - 1 - column)) & 1);
+	}
+}
+
+// Only the rows set in the rows mask are written
+void expandVideoRows(const uint64_t* video, uint32_t* pixels, uint32_t rows) {
+	for (unsigned row = 0; row < VIDEO_HEIGHT; row++, pixels += VIDEO_WIDTH) {
+		if (rows & (1u << row)) {
+			expandVideoRow(video[row], pixels);
+		}
+	}
+}
+
+void Chip8::expandVideo(uint32_t* pixels, uint32_t rows) const {
+	expandVideoRows(video, pixels, rows);
+}
+
+// 64-bit FNV-1a over the display, row by row from the leftmost pixel. Identical
+// frames hash the same on every host.
+uint64_t hashVideoRows(const uint64_t* rows) {
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (unsigned row = 0; row < VIDEO_HEIGHT; row++) {
+		for (int shift = 56; shift >= 0; shift -= 8) {
+			hash ^= (rows[row] >> shift) & 0xFF;
+			hash *= 0x100000001B3ull;
+		}
+	}
+	return hash;
+}
+
+uint64_t Chip8::hashVideo() const {
+	return hashVideoRows(video);
+}
+
+// Unknown opcodes are ignored
+void Chip8::OP_NULL(const Instruction& instruction) {
 }
 
 // CLS - Clears the display
-void Chip8::OP_00E0() {
-	std::fill(video, video+2048, 0);
+void Chip8::OP_00E0(const Instruction& instruction) {
+	std::fill(video, video + VIDEO_HEIGHT, 0);
+	dirtyRows = 0xFFFFFFFF;
 }
 
 // RET - Return from a subtroutine
-void Chip8::OP_00EE() {
+void Chip8::OP_00EE(const Instruction& instruction) {
 	stackPointer--;
 	programCounter = stack[stackPointer];
 }
 
 // JP addr - Jump to the address
-void Chip8::OP_1nnn() {
-	uint16_t address = opcode & 0x0FFF;
+void Chip8::OP_1nnn(const Instruction& instruction) {
+	uint16_t address = instruction.nnn;
 	programCounter = address;
 }
 
 // CALL addr - Calls the subroutine at the address
-void Chip8::OP_2nnn() {
+void Chip8::OP_2nnn(const Instruction& instruction) {
 	stack[stackPointer] = programCounter;
 	stackPointer++;
-	uint16_t address = opcode & 0x0FFF;
+	uint16_t address = instruction.nnn;
 	programCounter = address;
 }
 
 // SE Vx, byte - Skips the next instruction if Vx = byte
-void Chip8::OP_3xkk() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, byte = opcode & 0x00FF;
+void Chip8::OP_3xkk(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, byte = instruction.kk;
 	if (registers[Vx] == byte) {
 		programCounter += 2;
 	}
 }
 
 // SNE Vx, byte - Skips the next instruction if Vx != byte
-void Chip8::OP_4xkk() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, byte = opcode & 0x00FF;
+void Chip8::OP_4xkk(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, byte = instruction.kk;
 	if (registers[Vx] != byte) {
 		programCounter += 2;
 	}
 }
 
 //SE Vx, Vy - Skips the next instruction if Vx = Vy
-void Chip8::OP_5xy0() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_5xy0(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	if (registers[Vx] == registers[Vy]) {
 		programCounter += 2;
 	}
 }
 
 // LD Vx, byte - Sets Vx to byte
-void Chip8::OP_6xkk() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, byte = opcode & 0x00FF;
+void Chip8::OP_6xkk(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, byte = instruction.kk;
 	registers[Vx] = byte;
 }
 
 // ADD Vx, byte - Vx += byte
-void Chip8::OP_7xkk() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, byte = opcode & 0x00FF;
+void Chip8::OP_7xkk(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, byte = instruction.kk;
 	registers[Vx] += byte;
 }
 
 // LD Vx, Vy - Vx = Vy
-void Chip8::OP_8xy0() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy0(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	registers[Vx] = registers[Vy];
 }
 
 // OR Vx, Vy - Vx |= Vy
-void Chip8::OP_8xy1() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy1(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	registers[Vx] |= registers[Vy];
 }
 
 // AND Vx, Vy - Vx &= Vy
-void Chip8::OP_8xy2() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy2(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	registers[Vx] &= registers[Vy];
 }
 
 // XOR Vx, Vy - Vx ^= Vy
-void Chip8::OP_8xy3() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy3(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	registers[Vx] ^= registers[Vy];
 }
 
 // ADD Vx, Vy - Add Vx and Vy and if the result is bigger than 255 set the flag
 // register to 1, otherwise set to 0. Store the lowest 8 bits of the result in Vx.
-void Chip8::OP_8xy4() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy4(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	uint16_t sum = registers[Vx] + registers[Vy];
 	registers[Vx] = sum & 0xFF;
 	if (sum > 255) {
@@ -302,8 +1039,8 @@ void Chip8::OP_8xy4() {
 }
 
 // SUB Vx, Vy - Do Vx -= Vf and if Vx > Vf then set VF to 1, otherwise 0
-void Chip8::OP_8xy5() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy5(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	registers[Vx] -= registers[Vy];
 	if (registers[Vx] > registers[Vy]) {
 		registers[15] = 1;
@@ -315,16 +1052,16 @@ void Chip8::OP_8xy5() {
 
 // SHR Vx - Set VF to 1 if the least-sig bit of Vx is 1, otherwise 0, then
 // divide Vx by 2
-void Chip8::OP_8xy6() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_8xy6(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	registers[15] = registers[Vx] & 1;
 	registers[Vx] >>= 1;
 }
 
 // SUBN Vx, Vy - Set VF to 1 if Vy > Vx, otherwise set to 0, then subtract Vx
 // from Vy and store in Vx
-void Chip8::OP_8xy7() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_8xy7(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	if (registers[Vy] > registers[Vx]) {
 		registers[15] = 1;
 	}
@@ -336,138 +1073,94 @@ void Chip8::OP_8xy7() {
 
 // SHL Vx {, Vy} - Set VF to 1 if Vx's most-siginficant byte is 1 then multiply
 // Vx by 2
-void Chip8::OP_8xyE() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_8xyE(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	registers[15] = (registers[Vx] & 0x80) >> 7;
 	registers[Vx] <<= 1;
 }
 
 // SNE Vx, Vy - Skips the next instruction if Vx != Vy
-void Chip8::OP_9xy0() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4;
+void Chip8::OP_9xy0(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y;
 	if (registers[Vx] != registers[Vy]) {
 		programCounter += 2;
 	}
 }
 
 // LD I, addr - sets I = nnn
-void Chip8::OP_Annn() {
-	uint16_t address = opcode & 0x0FFF;
+void Chip8::OP_Annn(const Instruction& instruction) {
+	uint16_t address = instruction.nnn;
 	index = address;
 }
 
 // JP V0, addr - Jump to the address at nnn + V0
-void Chip8::OP_Bnnn() {
-	uint16_t address = opcode & 0x0FFF;
+void Chip8::OP_Bnnn(const Instruction& instruction) {
+	uint16_t address = instruction.nnn;
 	programCounter = registers[0] + address;
 }
 
 // RND Vx, byte - Set Vx = randomByte & kk
-void Chip8::OP_Cxkk() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, byte = opcode & 0x00FF;
-	registers[Vx] = randomByte(randomGen) & byte;
+void Chip8::OP_Cxkk(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, byte = instruction.kk;
+	registers[Vx] = (randomSource ? randomSource->nextByte() : randomGen.nextByte()) & byte;
 }
 
 
 // DRW Vx, Vy, nibble - Draw the sprite at memory address I at (Vx, Vy) and
-//  set VF = 1 if there is a collision
-void Chip8::OP_Dxyn() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, Vy = (opcode & 0x00F0) >> 4, height = opcode & 0x000F;
+//  set VF = 1 if there is a collision. Sprites are clipped at the screen edges.
+void Chip8::OP_Dxyn(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, Vy = instruction.y, height = instruction.n;
 	uint8_t xPos = registers[Vx] % VIDEO_WIDTH, yPos = registers[Vy] % VIDEO_HEIGHT;
-	registers[15] = 0;
-	for (int x = 0; x < height; x++) {
-		uint8_t spriteByte = memory[index + x];
-		for (int y = 0; y < 8; y++) {
-			uint8_t spritePixel = spriteByte & (0x80 >> y);
-			uint32_t* screenPixel = &video[(yPos + x) * VIDEO_WIDTH + (xPos + y)];
-
-			if (spritePixel)
-			{
-				// Screen pixel also on - collision
-				if (*screenPixel == 0xFFFFFFFF)
-				{
-					registers[15] = 1;
-				}
+	uint64_t collision = 0;
+	for (unsigned row = 0; row < height && yPos + row < VIDEO_HEIGHT; row++) {
+		// Line the sprite byte up with its columns in the row
+		uint64_t spriteByte = readByte(index + row), sprite;
+		if (xPos <= VIDEO_WIDTH - 8) {
+			sprite = spriteByte << (VIDEO_WIDTH - 8 - xPos);
+		}
+		else {
+			sprite = spriteByte >> (xPos - (VIDEO_WIDTH - 8));
+		}
 
-				// Effectively XOR with the sprite pixel
-				*screenPixel ^= 0xFFFFFFFF;
-			}
+		collision |= video[yPos + row] & sprite;
+		video[yPos + row] ^= sprite;
+		if (sprite) {
+			dirtyRows |= 1u << (yPos + row);
 		}
 	}
+	registers[15] = collision != 0;
 }
 
 // SKP Vx - Skips the next instruction if a key with the value in Vx is pressed
-void Chip8::OP_Ex9E() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, key = registers[Vx];
-	if (keys[key]) {
+void Chip8::OP_Ex9E(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, key = registers[Vx] & 0xF;
+	keypadReads++;
+	if (keys & (1 << key)) {
 		programCounter += 2;
 	}
 }
 
 // SKNP Vx - Skips the next instruction if a key with the value in Vx is not pressed
-void Chip8::OP_ExA1() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, key = registers[Vx];
-	if (!keys[key]) {
+void Chip8::OP_ExA1(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, key = registers[Vx] & 0xF;
+	keypadReads++;
+	if (!(keys & (1 << key))) {
 		programCounter += 2;
 	}
 }
 
 // LD Vx, DT - Set Vx to the delay timer value
-void Chip8::OP_Fx07() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_Fx07(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	registers[Vx] = delayTimer;
 }
 
 // LD Vx, K - Wait for a key press then store the key value in Vx
-void Chip8::OP_Fx0A() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
-	if (keys[0]) {
-		registers[Vx] = 0;
-	}
-	else if (keys[1]) {
-		registers[Vx] = 1;
-	}
-	else if (keys[2]) {
-		registers[Vx] = 2;
-	}
-	else if (keys[3]) {
-		registers[Vx] = 3;
-	}
-	else if (keys[4]) {
-		registers[Vx] = 4;
-	}
-	else if (keys[5]) {
-		registers[Vx] = 5;
-	}
-	else if (keys[6]) {
-		registers[Vx] = 6;
-	}
-	else if (keys[7]) {
-		registers[Vx] = 7;
-	}
-	else if (keys[8]) {
-		registers[Vx] = 8;
-	}
-	else if (keys[9]) {
-		registers[Vx] = 9;
-	}
-	else if (keys[10]) {
-		registers[Vx] = 10;
-	}
-	else if (keys[11]) {
-		registers[Vx] = 11;
-	}
-	else if (keys[12]) {
-		registers[Vx] = 12;
-	}
-	else if (keys[13]) {
-		registers[Vx] = 13;
-	}
-	else if (keys[14]) {
-		registers[Vx] = 14;
-	}
-	else if (keys[15]) {
-		registers[Vx] = 15;
+void Chip8::OP_Fx0A(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
+	keypadReads++;
+	if (keys) {
+		registers[Vx] = static_cast<uint8_t>(lowestSetBit(keys));
 	}
 	else {
 		// Decrement the program counter by 2 to rerun this instruction if nothing
@@ -477,58 +1170,144 @@ void Chip8::OP_Fx0A() {
 }
 
 // LD DT, Vx - Sets the delay time to Vx
-void Chip8::OP_Fx15() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_Fx15(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	delayTimer = registers[Vx];
 }
 
 // LD ST, Vx - Sets sound timer to Vx
-void Chip8::OP_Fx18() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_Fx18(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	soundTimer = registers[Vx];
 }
 
 // ADD I, Vx - Sets index += Vx
-void Chip8::OP_Fx1E() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_Fx1E(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	index += registers[Vx];
 }
 
 // LD F, Vx - Sets index to the sprite location for the digit in Vx
-void Chip8::OP_Fx29() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, digit = registers[Vx];
+void Chip8::OP_Fx29(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, digit = registers[Vx];
 	// Each digit is 5 bytes
 	index = FONTSET_START_ADDRESS + (5 * digit);
 }
 
 // LD B, Vx - Store the binary-coded decimal version of Vx in I, I+1, I+2
-void Chip8::OP_Fx33() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8, value = registers[Vx];
+void Chip8::OP_Fx33(const Instruction& instruction) {
+	uint8_t Vx = instruction.x, value = registers[Vx];
 	// Ones-place
-	memory[index + 2] = value % 10;
+	writeByte(index + 2, value % 10);
 	value /= 10;
 
 	// Tens-place
-	memory[index + 1] = value % 10;
+	writeByte(index + 1, value % 10);
 	value /= 10;
 
 	// Hundreds-place
-	memory[index] = value % 10;
-
+	writeByte(index, value % 10);
 }
 
 // LD [I], Vx - Store registers V0 - Vx in memory at [I]
-void Chip8::OP_Fx55() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_Fx55(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	for (int i = 0; i <= Vx; i++) {
-		memory[index = i] = registers[i];
+		writeByte(index + i, registers[i]);
 	}
 }
 
 // LD Vx, [I] - Read registers V0 - Vx in memory at [I]
-void Chip8::OP_Fx65() {
-	uint8_t Vx = (opcode & 0x0F00) >> 8;
+void Chip8::OP_Fx65(const Instruction& instruction) {
+	uint8_t Vx = instruction.x;
 	for (int i = 0; i <= Vx; i++) {
-		registers[i] = memory[index + i];
+		registers[i] = readByte(index + i);
+	}
+}
+
+// Annn then DRW - the usual way to draw a sprite
+unsigned Chip8::FUSED_Annn_Dxyn(const Instruction& instruction) {
+	OP_Annn(instruction);
+
+	const Instruction& draw = decodeCache[programCounter & 0x0FFF];
+	opcode = draw.opcode;
+	programCounter += 2;
+	OP_Dxyn(draw);
+	return 2;
+}
+
+// Two LD Vx, byte in a row, typically setting up sprite coordinates
+unsigned Chip8::FUSED_6xkk_6xkk(const Instruction& instruction) {
+	OP_6xkk(instruction);
+
+	const Instruction& load = decodeCache[programCounter & 0x0FFF];
+	opcode = load.opcode;
+	programCounter += 2;
+	OP_6xkk(load);
+	return 2;
+}
+
+// SE Vx, byte then JP - a conditional branch
+unsigned Chip8::FUSED_3xkk_1nnn(const Instruction& instruction) {
+	if (registers[instruction.x] == instruction.kk) {
+		programCounter += 2;
+		return 1;
+	}
+
+	const Instruction& jump = decodeCache[programCounter & 0x0FFF];
+	opcode = jump.opcode;
+	programCounter = jump.nnn;
+	return 2;
+}
+
+// SNE Vx, byte then JP - a conditional branch
+unsigned Chip8::FUSED_4xkk_1nnn(const Instruction& instruction) {
+	if (registers[instruction.x] != instruction.kk) {
+		programCounter += 2;
+		return 1;
+	}
+
+	const Instruction& jump = decodeCache[programCounter & 0x0FFF];
+	opcode = jump.opcode;
+	programCounter = jump.nnn;
+	return 2;
+}
+
+// LD Vx, DT; SE Vx, byte; JP - a loop waiting on the delay timer
+unsigned Chip8::FUSED_Fx07_3xkk_1nnn(const Instruction& instruction, unsigned count) {
+	uint16_t address = (programCounter - 2) & 0x0FFF;
+	registers[instruction.x] = delayTimer;
+
+	const Instruction& skip = decodeCache[programCounter & 0x0FFF];
+	opcode = skip.opcode;
+	programCounter += 2;
+	if (registers[skip.x] == skip.kk) {
+		programCounter += 2;
+		return 2;
+	}
+
+	const Instruction& jump = decodeCache[programCounter & 0x0FFF];
+	opcode = jump.opcode;
+	programCounter = jump.nnn;
+	if (jump.nnn != address) {
+		return 3;
+	}
+
+	// Back at the LD with the same delay timer, so every pass until the batch
+	// ends repeats this one. Stop where the last of them would have.
+	unsigned remaining = count - 3;
+	switch (remaining % 3) {
+		case 1:
+			opcode = instruction.opcode;
+			programCounter = address + 2;
+			break;
+		case 2:
+			opcode = skip.opcode;
+			programCounter = address + 4;
+			break;
+		default:
+			break;
 	}
+	idleInstructions += remaining;
+	return count;
 }
@@ -1,73 +1,256 @@
 #pragma once
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <chrono>
-#include <random>
+#include <memory>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "Random.h"
 
 const unsigned int ROM_START_ADDRESS = 0x200;
 const unsigned int FONTSET_START_ADDRESS = 0x50;
+const unsigned int FONTSET_SIZE = 80;
 const unsigned int VIDEO_HEIGHT = 32;
 const unsigned int VIDEO_WIDTH = 64;
+const unsigned int MEMORY_SIZE = 4096;
+const unsigned int FRAME_RATE = 60;
+
+extern const uint8_t FONTSET[FONTSET_SIZE];
+
+// FNV-1a over VIDEO_HEIGHT packed rows, for comparing framebuffers
+uint64_t hashVideoRows(const uint64_t* rows);
+// Expand packed rows to VIDEO_WIDTH RGBA pixels each
+void expandVideoRow(uint64_t bits, uint32_t* pixels);
+void expandVideoRows(const uint64_t* video, uint32_t* pixels, uint32_t rows);
+
+// Handler slots for the decoded-instruction cache, in the same order as
+// Chip8::handlers. DECODE marks a cache entry that has to be decoded before use.
+enum class Op : uint8_t {
+	DECODE,
+	NOP,
+	OP_00E0,
+	OP_00EE,
+	OP_1nnn,
+	OP_2nnn,
+	OP_3xkk,
+	OP_4xkk,
+	OP_5xy0,
+	OP_6xkk,
+	OP_7xkk,
+	OP_8xy0,
+	OP_8xy1,
+	OP_8xy2,
+	OP_8xy3,
+	OP_8xy4,
+	OP_8xy5,
+	OP_8xy6,
+	OP_8xy7,
+	OP_8xyE,
+	OP_9xy0,
+	OP_Annn,
+	OP_Bnnn,
+	OP_Cxkk,
+	OP_Dxyn,
+	OP_Ex9E,
+	OP_ExA1,
+	OP_Fx07,
+	OP_Fx0A,
+	OP_Fx15,
+	OP_Fx18,
+	OP_Fx1E,
+	OP_Fx29,
+	OP_Fx33,
+	OP_Fx55,
+	OP_Fx65,
+	COUNT
+};
+
+// Superinstructions: common sequences that Chip8::runBatch() executes with one
+// dispatch. Each is entered from the cache entry of its first instruction and
+// reads the rest from the entries that follow.
+enum class Fused : uint8_t {
+	FUSED_Annn_Dxyn,
+	FUSED_6xkk_6xkk,
+	FUSED_3xkk_1nnn,
+	FUSED_4xkk_1nnn,
+	FUSED_Fx07_3xkk_1nnn,
+	COUNT
+};
+
+// An opcode with its operand fields already unpacked
+struct Instruction {
+	uint16_t opcode;
+	uint16_t nnn;
+	Op op;
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t kk;
+	// What runBatch() jumps to: op, or Op::COUNT + a Fused value when this
+	// instruction starts a superinstruction of length instructions. A length of 0
+	// means the entry hasn't been checked for fusion yet, so dispatch is not valid.
+	uint8_t dispatch;
+	uint8_t length;
+};
 
 class Chip8 {
 public:
 	Chip8();
 
+	// Core CPU state, kept together so it spans as few cache lines as possible.
+	// Everything from opcode through randomGen is saved as one block by saveState().
 	uint16_t opcode;
-
-	// 1-15 are general purpose, 16 is flags
-	uint8_t registers[16];
-	uint16_t memory[4096];
 	uint16_t programCounter;
 	uint16_t index;
-
-	uint16_t stack[16];
 	uint8_t stackPointer;
-	
 	uint8_t delayTimer;
 	uint8_t soundTimer;
 
-	uint32_t video[64 * 32];
-	uint8_t keys[16];
-	
-	std::default_random_engine randomGen;
-	std::uniform_int_distribution<int> randomByte;
+	// 1-15 are general purpose, 16 is flags
+	uint8_t registers[16];
+	uint16_t stack[16];
+
+	uint8_t memory[MEMORY_SIZE];
+
+	// One row per element, the most significant bit is the leftmost pixel
+	uint64_t video[VIDEO_HEIGHT];
+	// One bit per row of video changed since the frontend last cleared it, all set
+	// at startup so the first frame is presented in full
+	uint32_t dirtyRows = 0xFFFFFFFF;
+	// Keypad state, bit n set while key n is held
+	uint16_t keys;
+	Xorshift32 randomGen;
+
+	// Overrides randomGen when set; not owned
+	RandomSource* randomSource = nullptr;
+
+	// Decoded instructions indexed by address, filled lazily by cycle(). A separate
+	// allocation, so the machine state itself stays a few kilobytes.
+	std::unique_ptr<Instruction[]> decodeCache;
+
+	// One bit per 256-byte page of memory written since Chip8Jit last checked
+	uint16_t writtenPages = 0;
+	// One bit per 256-byte page holding the start of a superinstruction
+	uint16_t fusedPages = 0;
+
+	// Instructions runBatch() counted as executed without running them, because
+	// they were spent in a wait loop that couldn't exit before the batch ended
+	uint64_t idleInstructions = 0;
+	// Ex9E, ExA1 and Fx0A executed, so the frontend can tell when the keypad is read
+	uint32_t keypadReads = 0;
+
+	// Instructions executed per 60 Hz frame by runFrame()
+	unsigned cyclesPerFrame = 10;
 
 	void cycle();
-	void load_rom(const char* romName);
+	void runBatch(unsigned count);
+	void runFrame();
+	bool load_rom(const char* romName);
+	void load_rom(const uint8_t* rom, size_t romSize);
 	void load_fonts();
+	void expandVideo(uint32_t* pixels, uint32_t rows = 0xFFFFFFFF) const;
+	uint64_t hashVideo() const;
+
+	size_t stateSize() const;
+	size_t saveState(uint8_t* buffer, size_t capacity) const;
+	bool loadState(const uint8_t* buffer, size_t size);
+
+	uint8_t readByte(uint16_t address) const;
+	void writeByte(uint16_t address, uint8_t value);
+	uint16_t readOpcode(uint16_t address) const;
+
+	Instruction& fetch();
+	void tickTimers();
 
-	void OP_00E0();
-	void OP_00EE();
-	void OP_1nnn();
-	void OP_2nnn();
-	void OP_3xkk();
-	void OP_4xkk();
-	void OP_5xy0();
-	void OP_6xkk();
-	void OP_7xkk();
-	void OP_8xy0();
-	void OP_8xy1();
-	void OP_8xy2();
-	void OP_8xy3();
-	void OP_8xy4();
-	void OP_8xy5();
-	void OP_8xy6();
-	void OP_8xy7();
-	void OP_8xyE();
-	void OP_9xy0();
-	void OP_Annn();
-	void OP_Bnnn();
-	void OP_Cxkk();
-	void OP_Dxyn();
-	void OP_Ex9E();
-	void OP_ExA1();
-	void OP_Fx07();
-	void OP_Fx0A();
-	void OP_Fx15();
-	void OP_Fx18();
-	void OP_Fx1E();
-	void OP_Fx29();
-	void OP_Fx33();
-	void OP_Fx55();
-	void OP_Fx65();
+	static Instruction decode(uint16_t opcode);
+	void prepare(uint16_t address);
+	void invalidate(uint16_t address);
+	void flushDecodeCache();
+
+	typedef void (Chip8::*Handler)(const Instruction&);
+	static const Handler handlers[static_cast<int>(Op::COUNT)];
+
+	void OP_NULL(const Instruction& instruction);
+
+	void OP_00E0(const Instruction& instruction);
+	void OP_00EE(const Instruction& instruction);
+	void OP_1nnn(const Instruction& instruction);
+	void OP_2nnn(const Instruction& instruction);
+	void OP_3xkk(const Instruction& instruction);
+	void OP_4xkk(const Instruction& instruction);
+	void OP_5xy0(const Instruction& instruction);
+	void OP_6xkk(const Instruction& instruction);
+	void OP_7xkk(const Instruction& instruction);
+	void OP_8xy0(const Instruction& instruction);
+	void OP_8xy1(const Instruction& instruction);
+	void OP_8xy2(const Instruction& instruction);
+	void OP_8xy3(const Instruction& instruction);
+	void OP_8xy4(const Instruction& instruction);
+	void OP_8xy5(const Instruction& instruction);
+	void OP_8xy6(const Instruction& instruction);
+	void OP_8xy7(const Instruction& instruction);
+	void OP_8xyE(const Instruction& instruction);
+	void OP_9xy0(const Instruction& instruction);
+	void OP_Annn(const Instruction& instruction);
+	void OP_Bnnn(const Instruction& instruction);
+	void OP_Cxkk(const Instruction& instruction);
+	void OP_Dxyn(const Instruction& instruction);
+	void OP_Ex9E(const Instruction& instruction);
+	void OP_ExA1(const Instruction& instruction);
+	void OP_Fx07(const Instruction& instruction);
+	void OP_Fx0A(const Instruction& instruction);
+	void OP_Fx15(const Instruction& instruction);
+	void OP_Fx18(const Instruction& instruction);
+	void OP_Fx1E(const Instruction& instruction);
+	void OP_Fx29(const Instruction& instruction);
+	void OP_Fx33(const Instruction& instruction);
+	void OP_Fx55(const Instruction& instruction);
+	void OP_Fx65(const Instruction& instruction);
+
+	// Superinstructions return how many instructions they executed, at most count
+	unsigned FUSED_Annn_Dxyn(const Instruction& instruction);
+	unsigned FUSED_6xkk_6xkk(const Instruction& instruction);
+	unsigned FUSED_3xkk_1nnn(const Instruction& instruction);
+	unsigned FUSED_4xkk_1nnn(const Instruction& instruction);
+	unsigned FUSED_Fx07_3xkk_1nnn(const Instruction& instruction, unsigned count);
 };
+
+// Addresses wrap at 4 KB
+inline uint8_t Chip8::readByte(uint16_t address) const {
+	return memory[address & 0x0FFF];
+}
+
+inline void Chip8::writeByte(uint16_t address, uint8_t value) {
+	memory[address & 0x0FFF] = value;
+	invalidate(address);
+}
+
+// Index of the lowest set bit, used to pick the lowest held key; mask must not be 0
+inline unsigned lowestSetBit(uint16_t mask) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Opcodes are stored big-endian; fetch both bytes with a single 16-bit load
+inline uint16_t Chip8::readOpcode(uint16_t address) const {
+	address &= 0x0FFF;
+	if (address == MEMORY_SIZE - 1) {
+		return (memory[address] << 8) | memory[0];
+	}
+
+	uint16_t word;
+	std::memcpy(&word, &memory[address], sizeof(word));
+#if defined(_MSC_VER)
+	return _byteswap_ushort(word);
+#else
+	return __builtin_bswap16(word);
+#endif
+}
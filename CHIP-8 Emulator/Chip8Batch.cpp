@@ -0,0 +1,445 @@
+#include "Chip8Batch.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+Chip8Batch::Chip8Batch(unsigned laneCount)
+	: laneCount(laneCount), privateLanes(0) {
+	for (unsigned i = 0; i < 16; i++) {
+		registers[i].assign(laneCount, 0);
+		stack[i].assign(laneCount, 0);
+	}
+	programCounter.assign(laneCount, ROM_START_ADDRESS);
+	index.assign(laneCount, 0);
+	stackPointer.assign(laneCount, 0);
+	delayTimer.assign(laneCount, 0);
+	soundTimer.assign(laneCount, 0);
+	video.assign(static_cast<size_t>(laneCount) * VIDEO_HEIGHT, 0);
+	keys.assign(laneCount, 0);
+	randomState.assign(laneCount, 0);
+	privateMemory.resize(laneCount);
+
+	sharedMemory.assign(MEMORY_SIZE, 0);
+	std::memcpy(&sharedMemory[FONTSET_START_ADDRESS], FONTSET, FONTSET_SIZE);
+
+	// Every lane gets its own stream unless seeded explicitly
+	for (unsigned lane = 0; lane < laneCount; lane++) {
+		seed(lane, lane + 1);
+	}
+}
+
+unsigned Chip8Batch::size() const {
+	return laneCount;
+}
+
+// Returns false, printing nothing, if the ROM could not be opened
+bool Chip8Batch::load_rom(const char* romName) {
+	std::ifstream romFile(romName, std::ios::binary);
+
+	if (!romFile.is_open()) {
+		return false;
+	}
+
+	std::vector<uint8_t> rom(MEMORY_SIZE - ROM_START_ADDRESS);
+	romFile.read(reinterpret_cast<char*>(rom.data()), rom.size());
+	load_rom(rom.data(), static_cast<size_t>(romFile.gcount()));
+	return true;
+}
+
+// Puts the same ROM into every lane and drops any private memory
+void Chip8Batch::load_rom(const uint8_t* rom, size_t romSize) {
+	romSize = std::min<size_t>(romSize, MEMORY_SIZE - ROM_START_ADDRESS);
+	std::fill(sharedMemory.begin() + ROM_START_ADDRESS, sharedMemory.end(), 0);
+	std::memcpy(&sharedMemory[ROM_START_ADDRESS], rom, romSize);
+
+	for (std::unique_ptr<uint8_t[]>& memory : privateMemory) {
+		memory.reset();
+	}
+	privateLanes = 0;
+}
+
+// Same stream as a Chip8 whose randomGen got the same seed
+void Chip8Batch::seed(unsigned lane, uint32_t seed) {
+	randomState[lane] = xorshift32Seed(seed);
+}
+
+const uint8_t* Chip8Batch::memoryOf(unsigned lane) const {
+	return privateMemory[lane] ? privateMemory[lane].get() : sharedMemory.data();
+}
+
+uint8_t Chip8Batch::readByte(unsigned lane, uint16_t address) const {
+	return memoryOf(lane)[address & 0x0FFF];
+}
+
+void Chip8Batch::writeByte(unsigned lane, uint16_t address, uint8_t value) {
+	if (!privateMemory[lane]) {
+		privateMemory[lane].reset(new uint8_t[MEMORY_SIZE]);
+		std::memcpy(privateMemory[lane].get(), sharedMemory.data(), MEMORY_SIZE);
+		privateLanes++;
+	}
+	privateMemory[lane][address & 0x0FFF] = value;
+}
+
+uint8_t Chip8Batch::randomByte(unsigned lane) {
+	return xorshift32Byte(randomState[lane]);
+}
+
+uint64_t Chip8Batch::hashVideo(unsigned lane) const {
+	return hashVideoRows(&video[static_cast<size_t>(lane) * VIDEO_HEIGHT]);
+}
+
+// Runs one 60 Hz frame on every lane: cyclesPerFrame steps, then a timer tick
+void Chip8Batch::runFrame() {
+	for (unsigned i = 0; i < cyclesPerFrame; i++) {
+		step();
+	}
+	tickTimers();
+}
+
+void Chip8Batch::tickTimers() {
+	for (unsigned lane = 0; lane < laneCount; lane++) {
+		delayTimer[lane] -= delayTimer[lane] > 0;
+		soundTimer[lane] -= soundTimer[lane] > 0;
+	}
+}
+
+// Executes one instruction on every lane
+void Chip8Batch::step() {
+	if (stepUniform()) {
+		return;
+	}
+
+	for (unsigned lane = 0; lane < laneCount; lane++) {
+		const uint8_t* memory = memoryOf(lane);
+		uint16_t pc = programCounter[lane];
+		Instruction instruction = Chip8::decode((memory[pc & 0x0FFF] << 8) | memory[(pc + 1) & 0x0FFF]);
+		programCounter[lane] = pc + 2;
+		executeLane(lane, instruction);
+	}
+}
+
+// Fast path for the common case where every lane is about to run the same
+// instruction: decode it once and apply it to all lanes with loops over the
+// register arrays. Returns false, having changed nothing, when the lanes have
+// diverged or the instruction needs the per-lane path.
+bool Chip8Batch::stepUniform() {
+	if (laneCount == 0) {
+		return false;
+	}
+
+	const uint16_t pc = programCounter[0];
+	uint16_t differences = 0;
+	for (unsigned lane = 0; lane < laneCount; lane++) {
+		differences |= programCounter[lane] ^ pc;
+	}
+	if (differences) {
+		return false;
+	}
+
+	// Lanes with private memory may have rewritten the code at pc, so the
+	// instruction is only uniform if it reads the same in all of them
+	const uint16_t opcode = (sharedMemory[pc & 0x0FFF] << 8) | sharedMemory[(pc + 1) & 0x0FFF];
+	if (privateLanes != 0) {
+		for (unsigned lane = 0; lane < laneCount; lane++) {
+			const uint8_t* memory = memoryOf(lane);
+			if (((memory[pc & 0x0FFF] << 8) | memory[(pc + 1) & 0x0FFF]) != opcode) {
+				return false;
+			}
+		}
+	}
+
+	const Instruction instruction = Chip8::decode(opcode);
+	const unsigned n = laneCount;
+	const uint16_t next = pc + 2;
+	const uint8_t kk = instruction.kk;
+	uint8_t* vx = registers[instruction.x].data();
+	const uint8_t* vy = registers[instruction.y].data();
+	uint8_t* vf = registers[15].data();
+	uint16_t* pcs = programCounter.data();
+	bool jumped = false;
+
+	switch (instruction.op) {
+		case Op::NOP:
+			break;
+		case Op::OP_1nnn:
+			std::fill(pcs, pcs + n, instruction.nnn);
+			jumped = true;
+			break;
+		case Op::OP_3xkk:
+			for (unsigned l = 0; l < n; l++) {
+				pcs[l] = next + ((vx[l] == kk) << 1);
+			}
+			jumped = true;
+			break;
+		case Op::OP_4xkk:
+			for (unsigned l = 0; l < n; l++) {
+				pcs[l] = next + ((vx[l] != kk) << 1);
+			}
+			jumped = true;
+			break;
+		case Op::OP_5xy0:
+			for (unsigned l = 0; l < n; l++) {
+				pcs[l] = next + ((vx[l] == vy[l]) << 1);
+			}
+			jumped = true;
+			break;
+		case Op::OP_9xy0:
+			for (unsigned l = 0; l < n; l++) {
+				pcs[l] = next + ((vx[l] != vy[l]) << 1);
+			}
+			jumped = true;
+			break;
+		case Op::OP_6xkk:
+			std::fill(vx, vx + n, kk);
+			break;
+		case Op::OP_7xkk:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] += kk;
+			}
+			break;
+		case Op::OP_8xy0:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] = vy[l];
+			}
+			break;
+		case Op::OP_8xy1:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] |= vy[l];
+			}
+			break;
+		case Op::OP_8xy2:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] &= vy[l];
+			}
+			break;
+		case Op::OP_8xy3:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] ^= vy[l];
+			}
+			break;
+		case Op::OP_8xy4:
+			for (unsigned l = 0; l < n; l++) {
+				unsigned sum = vx[l] + vy[l];
+				vx[l] = sum & 0xFF;
+				vf[l] = sum > 255;
+			}
+			break;
+		case Op::OP_8xy5:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] -= vy[l];
+				vf[l] = vx[l] > vy[l];
+			}
+			break;
+		case Op::OP_8xy6:
+			for (unsigned l = 0; l < n; l++) {
+				vf[l] = vx[l] & 1;
+				vx[l] >>= 1;
+			}
+			break;
+		case Op::OP_8xy7:
+			for (unsigned l = 0; l < n; l++) {
+				vf[l] = vy[l] > vx[l];
+				vx[l] = vy[l] - vx[l];
+			}
+			break;
+		case Op::OP_8xyE:
+			for (unsigned l = 0; l < n; l++) {
+				vf[l] = (vx[l] & 0x80) >> 7;
+				vx[l] <<= 1;
+			}
+			break;
+		case Op::OP_Annn:
+			std::fill(index.begin(), index.end(), instruction.nnn);
+			break;
+		case Op::OP_Fx07:
+			for (unsigned l = 0; l < n; l++) {
+				vx[l] = delayTimer[l];
+			}
+			break;
+		case Op::OP_Fx15:
+			for (unsigned l = 0; l < n; l++) {
+				delayTimer[l] = vx[l];
+			}
+			break;
+		case Op::OP_Fx18:
+			for (unsigned l = 0; l < n; l++) {
+				soundTimer[l] = vx[l];
+			}
+			break;
+		case Op::OP_Fx1E:
+			for (unsigned l = 0; l < n; l++) {
+				index[l] += vx[l];
+			}
+			break;
+		case Op::OP_Fx29:
+			for (unsigned l = 0; l < n; l++) {
+				index[l] = FONTSET_START_ADDRESS + 5 * vx[l];
+			}
+			break;
+		default:
+			return false;
+	}
+
+	if (!jumped) {
+		std::fill(pcs, pcs + n, next);
+	}
+	return true;
+}
+
+// Executes an instruction on one lane, with the program counter already past
+// it. Mirrors the Chip8::OP_* handlers.
+void Chip8Batch::executeLane(unsigned lane, const Instruction& instruction) {
+	uint8_t& Vx = registers[instruction.x][lane];
+	uint8_t& Vy = registers[instruction.y][lane];
+	uint8_t& VF = registers[15][lane];
+	uint16_t& pc = programCounter[lane];
+	uint8_t& sp = stackPointer[lane];
+	uint16_t& I = index[lane];
+	uint64_t* rows = &video[static_cast<size_t>(lane) * VIDEO_HEIGHT];
+
+	switch (instruction.op) {
+		case Op::OP_00E0:
+			std::fill(rows, rows + VIDEO_HEIGHT, 0);
+			break;
+		case Op::OP_00EE:
+			sp--;
+			pc = stack[sp & 0xF][lane];
+			break;
+		case Op::OP_1nnn:
+			pc = instruction.nnn;
+			break;
+		case Op::OP_2nnn:
+			stack[sp & 0xF][lane] = pc;
+			sp++;
+			pc = instruction.nnn;
+			break;
+		case Op::OP_3xkk:
+			pc += (Vx == instruction.kk) << 1;
+			break;
+		case Op::OP_4xkk:
+			pc += (Vx != instruction.kk) << 1;
+			break;
+		case Op::OP_5xy0:
+			pc += (Vx == Vy) << 1;
+			break;
+		case Op::OP_6xkk:
+			Vx = instruction.kk;
+			break;
+		case Op::OP_7xkk:
+			Vx += instruction.kk;
+			break;
+		case Op::OP_8xy0:
+			Vx = Vy;
+			break;
+		case Op::OP_8xy1:
+			Vx |= Vy;
+			break;
+		case Op::OP_8xy2:
+			Vx &= Vy;
+			break;
+		case Op::OP_8xy3:
+			Vx ^= Vy;
+			break;
+		case Op::OP_8xy4: {
+			unsigned sum = Vx + Vy;
+			Vx = sum & 0xFF;
+			VF = sum > 255;
+			break;
+		}
+		case Op::OP_8xy5:
+			Vx -= Vy;
+			VF = Vx > Vy;
+			break;
+		case Op::OP_8xy6:
+			VF = Vx & 1;
+			Vx >>= 1;
+			break;
+		case Op::OP_8xy7:
+			VF = Vy > Vx;
+			Vx = Vy - Vx;
+			break;
+		case Op::OP_8xyE:
+			VF = (Vx & 0x80) >> 7;
+			Vx <<= 1;
+			break;
+		case Op::OP_9xy0:
+			pc += (Vx != Vy) << 1;
+			break;
+		case Op::OP_Annn:
+			I = instruction.nnn;
+			break;
+		case Op::OP_Bnnn:
+			pc = registers[0][lane] + instruction.nnn;
+			break;
+		case Op::OP_Cxkk:
+			Vx = randomByte(lane) & instruction.kk;
+			break;
+		case Op::OP_Dxyn: {
+			uint8_t xPos = Vx % VIDEO_WIDTH, yPos = Vy % VIDEO_HEIGHT;
+			uint64_t collision = 0;
+			for (unsigned row = 0; row < instruction.n && yPos + row < VIDEO_HEIGHT; row++) {
+				uint64_t spriteByte = readByte(lane, I + row), sprite;
+				if (xPos <= VIDEO_WIDTH - 8) {
+					sprite = spriteByte << (VIDEO_WIDTH - 8 - xPos);
+				}
+				else {
+					sprite = spriteByte >> (xPos - (VIDEO_WIDTH - 8));
+				}
+				collision |= rows[yPos + row] & sprite;
+				rows[yPos + row] ^= sprite;
+			}
+			VF = collision != 0;
+			break;
+		}
+		case Op::OP_Ex9E:
+			pc += ((keys[lane] >> (Vx & 0xF)) & 1) << 1;
+			break;
+		case Op::OP_ExA1:
+			pc += (((keys[lane] >> (Vx & 0xF)) & 1) ^ 1) << 1;
+			break;
+		case Op::OP_Fx07:
+			Vx = delayTimer[lane];
+			break;
+		case Op::OP_Fx0A:
+			if (keys[lane]) {
+				Vx = static_cast<uint8_t>(lowestSetBit(keys[lane]));
+			}
+			else {
+				pc -= 2;
+			}
+			break;
+		case Op::OP_Fx15:
+			delayTimer[lane] = Vx;
+			break;
+		case Op::OP_Fx18:
+			soundTimer[lane] = Vx;
+			break;
+		case Op::OP_Fx1E:
+			I += Vx;
+			break;
+		case Op::OP_Fx29:
+			I = FONTSET_START_ADDRESS + 5 * Vx;
+			break;
+		case Op::OP_Fx33: {
+			uint8_t value = Vx;
+			writeByte(lane, I + 2, value % 10);
+			value /= 10;
+			writeByte(lane, I + 1, value % 10);
+			value /= 10;
+			writeByte(lane, I, value % 10);
+			break;
+		}
+		case Op::OP_Fx55:
+			for (unsigned i = 0; i <= instruction.x; i++) {
+				writeByte(lane, I + i, registers[i][lane]);
+			}
+			break;
+		case Op::OP_Fx65:
+			for (unsigned i = 0; i <= instruction.x; i++) {
+				registers[i][lane] = readByte(lane, I + i);
+			}
+			break;
+		default:
+			break;
+	}
+}
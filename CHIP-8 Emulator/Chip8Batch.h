@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Chip8.h"
+
+// Many CHIP-8 machines stepped in lockstep, stored as structure-of-arrays: each
+// register, the program counters, I, the timers and so on live in one array
+// indexed by lane. Built for running one ROM under thousands of input or RNG
+// variations. While every lane sits at the same program counter and finds the
+// same instruction there, it is decoded once and applied to all lanes with plain
+// loops over those arrays, which the compiler vectorizes.
+class Chip8Batch {
+public:
+	explicit Chip8Batch(unsigned laneCount);
+
+	unsigned size() const;
+
+	bool load_rom(const char* romName);
+	void load_rom(const uint8_t* rom, size_t romSize);
+	void seed(unsigned lane, uint32_t seed);
+
+	void step();
+	void runFrame();
+	void tickTimers();
+
+	uint8_t readByte(unsigned lane, uint16_t address) const;
+	uint64_t hashVideo(unsigned lane) const;
+
+	// Instructions executed per 60 Hz frame by runFrame()
+	unsigned cyclesPerFrame = 10;
+
+	// registers[n][lane] is Vn of that lane, stack[n][lane] the nth stack slot
+	std::vector<uint8_t> registers[16];
+	std::vector<uint16_t> stack[16];
+	std::vector<uint16_t> programCounter;
+	std::vector<uint16_t> index;
+	std::vector<uint8_t> stackPointer;
+	std::vector<uint8_t> delayTimer;
+	std::vector<uint8_t> soundTimer;
+
+	// VIDEO_HEIGHT packed rows per lane, laid out lane after lane
+	std::vector<uint64_t> video;
+	// Keypad state, one bit per key
+	std::vector<uint16_t> keys;
+	// xorshift32 state per lane, the same generator as Chip8::randomGen
+	std::vector<uint32_t> randomState;
+
+private:
+	unsigned laneCount;
+
+	// Lanes read the shared image until they first write memory, then get a
+	// private copy
+	std::vector<uint8_t> sharedMemory;
+	std::vector<std::unique_ptr<uint8_t[]>> privateMemory;
+	unsigned privateLanes;
+
+	const uint8_t* memoryOf(unsigned lane) const;
+	void writeByte(unsigned lane, uint16_t address, uint8_t value);
+	uint8_t randomByte(unsigned lane);
+
+	bool stepUniform();
+	void executeLane(unsigned lane, const Instruction& instruction);
+};
@@ -0,0 +1,627 @@
+#include "Chip8Jit.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_X64
+#endif
+
+#ifdef CHIP8_JIT_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#ifdef CHIP8_JIT_X64
+namespace {
+
+enum HostRegister : uint8_t {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// RAX is scratch, R11 holds the Chip8 pointer and RSP is left alone; everything
+// else can hold CHIP-8 registers for the duration of a block.
+const uint8_t ALLOCATABLE[] = { RCX, RDX, RBX, RBP, RSI, RDI, R8, R9, R10, R12, R13, R14, R15 };
+const unsigned ALLOCATABLE_COUNT = sizeof(ALLOCATABLE);
+
+#ifdef _WIN32
+const uint8_t ARGUMENT = RCX;
+const uint8_t CALLEE_SAVED[] = { RBX, RBP, RSI, RDI, R12, R13, R14, R15 };
+#else
+const uint8_t ARGUMENT = RDI;
+const uint8_t CALLEE_SAVED[] = { RBX, RBP, R12, R13, R14, R15 };
+#endif
+
+// Opcode bytes for "op r/m8, r8" and the /digit extensions for the immediate forms
+const uint8_t ADD_BYTE = 0x00, OR_BYTE = 0x08, AND_BYTE = 0x20, SUB_BYTE = 0x28, XOR_BYTE = 0x30, CMP_BYTE = 0x38, MOV_BYTE = 0x88;
+const uint8_t EXT_ADD = 0, EXT_AND = 4, EXT_CMP = 7, EXT_SHL = 4, EXT_SHR = 5;
+const uint8_t CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7;
+
+// Minimal x86-64 encoder covering the handful of instruction forms the JIT emits.
+// Memory operands are always [R11 + disp32].
+class Emitter {
+public:
+	Emitter(uint8_t* buffer) : start(buffer), out(buffer) {}
+
+	unsigned size() const {
+		return static_cast<unsigned>(out - start);
+	}
+
+	void byte(uint8_t value) {
+		*out++ = value;
+	}
+
+	void word(uint16_t value) {
+		byte(value & 0xFF);
+		byte(value >> 8);
+	}
+
+	void dword(uint32_t value) {
+		for (int i = 0; i < 4; i++) {
+			byte((value >> (8 * i)) & 0xFF);
+		}
+	}
+
+	// Byte operations always carry a REX prefix so SPL/BPL/SIL/DIL are addressable
+	void rex(bool wide, uint8_t reg, uint8_t rm, bool force) {
+		uint8_t value = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+		if (value != 0x40 || force) {
+			byte(value);
+		}
+	}
+
+	void modrm(uint8_t reg, uint8_t rm) {
+		byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	void modrmMemory(uint8_t reg, int32_t displacement) {
+		byte(0x80 | ((reg & 7) << 3) | (R11 & 7));
+		dword(static_cast<uint32_t>(displacement));
+	}
+
+	void aluByte(uint8_t opcode, uint8_t dst, uint8_t src) {
+		rex(false, src, dst, true);
+		byte(opcode);
+		modrm(src, dst);
+	}
+
+	void aluByteImm(uint8_t extension, uint8_t dst, uint8_t value) {
+		rex(false, 0, dst, true);
+		byte(0x80);
+		modrm(extension, dst);
+		byte(value);
+	}
+
+	void movByteImm(uint8_t dst, uint8_t value) {
+		rex(false, 0, dst, true);
+		byte(0xB0 + (dst & 7));
+		byte(value);
+	}
+
+	void shiftByte(uint8_t extension, uint8_t dst, uint8_t amount) {
+		rex(false, 0, dst, true);
+		byte(amount == 1 ? 0xD0 : 0xC0);
+		modrm(extension, dst);
+		if (amount != 1) {
+			byte(amount);
+		}
+	}
+
+	void setcc(uint8_t condition, uint8_t dst) {
+		rex(false, 0, dst, true);
+		byte(0x0F);
+		byte(0x90 | condition);
+		modrm(0, dst);
+	}
+
+	// movzx r32, byte [R11 + displacement]
+	void loadByte(uint8_t dst, int32_t displacement) {
+		rex(false, dst, R11, false);
+		byte(0x0F);
+		byte(0xB6);
+		modrmMemory(dst, displacement);
+	}
+
+	// movzx r32, word [R11 + displacement]
+	void loadWord(uint8_t dst, int32_t displacement) {
+		rex(false, dst, R11, false);
+		byte(0x0F);
+		byte(0xB7);
+		modrmMemory(dst, displacement);
+	}
+
+	void storeByte(int32_t displacement, uint8_t src) {
+		rex(false, src, R11, true);
+		byte(0x88);
+		modrmMemory(src, displacement);
+	}
+
+	void storeWord(int32_t displacement, uint8_t src) {
+		byte(0x66);
+		rex(false, src, R11, false);
+		byte(0x89);
+		modrmMemory(src, displacement);
+	}
+
+	void storeWordImm(int32_t displacement, uint16_t value) {
+		byte(0x66);
+		rex(false, 0, R11, false);
+		byte(0xC7);
+		modrmMemory(0, displacement);
+		word(value);
+	}
+
+	void movImm(uint8_t dst, uint32_t value) {
+		rex(false, 0, dst, false);
+		byte(0xB8 + (dst & 7));
+		dword(value);
+	}
+
+	void movzxByte(uint8_t dst, uint8_t src) {
+		rex(false, dst, src, true);
+		byte(0x0F);
+		byte(0xB6);
+		modrm(dst, src);
+	}
+
+	void mov64(uint8_t dst, uint8_t src) {
+		rex(true, src, dst, false);
+		byte(0x89);
+		modrm(src, dst);
+	}
+
+	void mov32(uint8_t dst, uint8_t src) {
+		rex(false, src, dst, false);
+		byte(0x89);
+		modrm(src, dst);
+	}
+
+	void add32(uint8_t dst, uint8_t src) {
+		rex(false, src, dst, false);
+		byte(0x01);
+		modrm(src, dst);
+	}
+
+	void and32Imm(uint8_t dst, uint32_t value) {
+		rex(false, 0, dst, false);
+		byte(0x81);
+		modrm(EXT_AND, dst);
+		dword(value);
+	}
+
+	void add32Imm(uint8_t dst, uint32_t value) {
+		rex(false, 0, dst, false);
+		byte(0x81);
+		modrm(EXT_ADD, dst);
+		dword(value);
+	}
+
+	// imul eax, eax, value
+	void imulEaxImm(int8_t value) {
+		byte(0x6B);
+		modrm(RAX, RAX);
+		byte(static_cast<uint8_t>(value));
+	}
+
+	void xorEax() {
+		byte(0x31);
+		modrm(RAX, RAX);
+	}
+
+	// lea eax, [rax * 2 + displacement]
+	void leaEaxDouble(int32_t displacement) {
+		byte(0x8D);
+		byte(0x04);
+		byte(0x45);
+		dword(static_cast<uint32_t>(displacement));
+	}
+
+	void push(uint8_t reg) {
+		rex(false, 0, reg, false);
+		byte(0x50 + (reg & 7));
+	}
+
+	void pop(uint8_t reg) {
+		rex(false, 0, reg, false);
+		byte(0x58 + (reg & 7));
+	}
+
+	void ret() {
+		byte(0xC3);
+	}
+
+private:
+	uint8_t* start;
+	uint8_t* out;
+};
+
+bool translatable(Op op) {
+	switch (op) {
+		case Op::OP_1nnn:
+		case Op::OP_3xkk:
+		case Op::OP_4xkk:
+		case Op::OP_5xy0:
+		case Op::OP_6xkk:
+		case Op::OP_7xkk:
+		case Op::OP_8xy0:
+		case Op::OP_8xy1:
+		case Op::OP_8xy2:
+		case Op::OP_8xy3:
+		case Op::OP_8xy4:
+		case Op::OP_8xy5:
+		case Op::OP_8xy6:
+		case Op::OP_8xy7:
+		case Op::OP_8xyE:
+		case Op::OP_9xy0:
+		case Op::OP_Annn:
+		case Op::OP_Fx1E:
+		case Op::OP_Fx29:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Jumps and skips end a block; they are the only instructions that choose the
+// next program counter.
+bool terminates(Op op) {
+	switch (op) {
+		case Op::OP_1nnn:
+		case Op::OP_3xkk:
+		case Op::OP_4xkk:
+		case Op::OP_5xy0:
+		case Op::OP_9xy0:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Bit mask of the CHIP-8 registers an instruction touches, with bit 16 standing
+// for the index register
+uint32_t registersUsed(const Instruction& instruction) {
+	const uint32_t X = 1u << instruction.x, Y = 1u << instruction.y, VF = 1u << 15, INDEX = 1u << 16;
+	switch (instruction.op) {
+		case Op::OP_3xkk:
+		case Op::OP_4xkk:
+		case Op::OP_6xkk:
+		case Op::OP_7xkk:
+			return X;
+		case Op::OP_5xy0:
+		case Op::OP_9xy0:
+		case Op::OP_8xy0:
+		case Op::OP_8xy1:
+		case Op::OP_8xy2:
+		case Op::OP_8xy3:
+			return X | Y;
+		case Op::OP_8xy4:
+		case Op::OP_8xy5:
+		case Op::OP_8xy7:
+			return X | Y | VF;
+		case Op::OP_8xy6:
+		case Op::OP_8xyE:
+			return X | VF;
+		case Op::OP_Annn:
+			return INDEX;
+		case Op::OP_Fx1E:
+		case Op::OP_Fx29:
+			return X | INDEX;
+		default:
+			return 0;
+	}
+}
+
+unsigned bitCount(uint32_t value) {
+	unsigned count = 0;
+	for (; value; value &= value - 1) {
+		count++;
+	}
+	return count;
+}
+
+}
+#endif
+
+Chip8Jit::Chip8Jit(Chip8& chip8)
+	: chip8(chip8), arena(nullptr), arenaUsed(0) {
+#ifdef CHIP8_JIT_X64
+#ifdef _WIN32
+	arena = static_cast<uint8_t*>(VirtualAlloc(nullptr, ARENA_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+	void* memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	arena = memory == MAP_FAILED ? nullptr : static_cast<uint8_t*>(memory);
+#endif
+#endif
+	flush();
+}
+
+Chip8Jit::~Chip8Jit() {
+#ifdef CHIP8_JIT_X64
+	if (arena) {
+#ifdef _WIN32
+		VirtualFree(arena, 0, MEM_RELEASE);
+#else
+		munmap(arena, ARENA_SIZE);
+#endif
+	}
+#endif
+}
+
+// Throws away every translated block
+void Chip8Jit::flush() {
+	for (Block& block : blocks) {
+		block.valid = false;
+	}
+	for (std::vector<uint16_t>& page : pageBlocks) {
+		page.clear();
+	}
+	arenaUsed = 0;
+}
+
+void Chip8Jit::invalidatePages(uint16_t pages) {
+	for (unsigned page = 0; page < PAGE_COUNT; page++) {
+		if (pages & (1 << page)) {
+			for (uint16_t start : pageBlocks[page]) {
+				blocks[start].valid = false;
+			}
+			pageBlocks[page].clear();
+		}
+	}
+}
+
+// Executes count instructions with the same result as calling Chip8::cycle()
+// count times
+void Chip8Jit::run(unsigned count) {
+#ifdef CHIP8_JIT_X64
+	if (!arena) {
+		chip8.runBatch(count);
+		return;
+	}
+
+	while (count > 0) {
+		if (chip8.writtenPages) {
+			invalidatePages(chip8.writtenPages);
+			chip8.writtenPages = 0;
+		}
+
+		uint16_t address = chip8.programCounter;
+		if (address >= MEMORY_SIZE - 1) {
+			chip8.cycle();
+			count--;
+			continue;
+		}
+
+		Block* block = &blocks[address];
+		if (!block->valid) {
+			block = &compile(address);
+		}
+
+		if (block->length == 0 || block->length > count) {
+			chip8.cycle();
+			count--;
+			continue;
+		}
+
+		block->code(&chip8);
+		count -= block->length;
+	}
+#else
+	chip8.runBatch(count);
+#endif
+}
+
+// Same as Chip8::runFrame(), with the frame's instructions going through the JIT
+void Chip8Jit::runFrame() {
+	run(chip8.cyclesPerFrame);
+	chip8.tickTimers();
+}
+
+// Translates the run of instructions starting at address. A block with length 0
+// marks an address whose first instruction has to be interpreted.
+Chip8Jit::Block& Chip8Jit::compile(uint16_t address) {
+#ifdef CHIP8_JIT_X64
+	if (ARENA_SIZE - arenaUsed < MAX_BLOCK_BYTES) {
+		flush();
+	}
+
+	Instruction instructions[MAX_BLOCK_LENGTH];
+	unsigned length = 0;
+	uint32_t used = 0;
+	uint16_t pc = address;
+
+	while (length < MAX_BLOCK_LENGTH && pc < MEMORY_SIZE - 1) {
+		Instruction instruction = Chip8::decode(chip8.readOpcode(pc));
+		if (!translatable(instruction.op)) {
+			break;
+		}
+
+		uint32_t needed = used | registersUsed(instruction);
+		if (bitCount(needed) > ALLOCATABLE_COUNT) {
+			break;
+		}
+
+		used = needed;
+		instructions[length++] = instruction;
+		pc += 2;
+
+		if (terminates(instruction.op)) {
+			break;
+		}
+	}
+
+	Block& block = blocks[address];
+	block.valid = true;
+	block.start = address;
+	block.end = length ? pc : address + 2;
+	block.length = static_cast<uint16_t>(length);
+	block.code = nullptr;
+
+	for (unsigned page = block.start >> PAGE_SHIFT; page <= static_cast<unsigned>(block.end - 1) >> PAGE_SHIFT && page < PAGE_COUNT; page++) {
+		pageBlocks[page].push_back(address);
+	}
+
+	if (length == 0) {
+		return block;
+	}
+
+	// Pin every CHIP-8 register the block touches to a host register
+	uint8_t host[17] = {};
+	unsigned next = 0;
+	for (unsigned i = 0; i < 17; i++) {
+		if (used & (1u << i)) {
+			host[i] = ALLOCATABLE[next++];
+		}
+	}
+
+	const uint8_t* base = reinterpret_cast<const uint8_t*>(&chip8);
+	const int32_t registersOffset = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(chip8.registers) - base);
+	const int32_t indexOffset = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&chip8.index) - base);
+	const int32_t pcOffset = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&chip8.programCounter) - base);
+	const int32_t opcodeOffset = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&chip8.opcode) - base);
+	const uint8_t INDEX = 16, VF = 15;
+
+#ifdef _WIN32
+	DWORD oldProtection;
+	VirtualProtect(arena, ARENA_SIZE, PAGE_READWRITE, &oldProtection);
+#else
+	mprotect(arena, ARENA_SIZE, PROT_READ | PROT_WRITE);
+#endif
+
+	Emitter emit(arena + arenaUsed);
+
+	for (uint8_t reg : CALLEE_SAVED) {
+		emit.push(reg);
+	}
+	emit.mov64(R11, ARGUMENT);
+
+	for (unsigned i = 0; i < 16; i++) {
+		if (used & (1u << i)) {
+			emit.loadByte(host[i], registersOffset + i);
+		}
+	}
+	if (used & (1u << INDEX)) {
+		emit.loadWord(host[INDEX], indexOffset);
+	}
+
+	for (unsigned i = 0; i < length; i++) {
+		const Instruction& instruction = instructions[i];
+		const uint16_t following = address + 2 * (i + 1);
+		uint8_t x = host[instruction.x], y = host[instruction.y];
+
+		switch (instruction.op) {
+			case Op::OP_1nnn:
+				emit.movImm(RAX, instruction.nnn);
+				break;
+			case Op::OP_3xkk:
+			case Op::OP_4xkk:
+				emit.xorEax();
+				emit.aluByteImm(EXT_CMP, x, instruction.kk);
+				emit.setcc(instruction.op == Op::OP_3xkk ? CC_E : CC_NE, RAX);
+				emit.leaEaxDouble(following);
+				break;
+			case Op::OP_5xy0:
+			case Op::OP_9xy0:
+				emit.xorEax();
+				emit.aluByte(CMP_BYTE, x, y);
+				emit.setcc(instruction.op == Op::OP_5xy0 ? CC_E : CC_NE, RAX);
+				emit.leaEaxDouble(following);
+				break;
+			case Op::OP_6xkk:
+				emit.movByteImm(x, instruction.kk);
+				break;
+			case Op::OP_7xkk:
+				emit.aluByteImm(EXT_ADD, x, instruction.kk);
+				break;
+			case Op::OP_8xy0:
+				emit.aluByte(MOV_BYTE, x, y);
+				break;
+			case Op::OP_8xy1:
+				emit.aluByte(OR_BYTE, x, y);
+				break;
+			case Op::OP_8xy2:
+				emit.aluByte(AND_BYTE, x, y);
+				break;
+			case Op::OP_8xy3:
+				emit.aluByte(XOR_BYTE, x, y);
+				break;
+			case Op::OP_8xy4:
+				emit.aluByte(ADD_BYTE, x, y);
+				emit.setcc(CC_B, host[VF]);
+				break;
+			case Op::OP_8xy5:
+				emit.aluByte(SUB_BYTE, x, y);
+				emit.aluByte(CMP_BYTE, x, y);
+				emit.setcc(CC_A, host[VF]);
+				break;
+			case Op::OP_8xy6:
+				emit.aluByte(MOV_BYTE, host[VF], x);
+				emit.aluByteImm(EXT_AND, host[VF], 1);
+				emit.shiftByte(EXT_SHR, x, 1);
+				break;
+			case Op::OP_8xy7:
+				emit.aluByte(CMP_BYTE, y, x);
+				emit.setcc(CC_A, host[VF]);
+				emit.aluByte(MOV_BYTE, RAX, y);
+				emit.aluByte(SUB_BYTE, RAX, x);
+				emit.aluByte(MOV_BYTE, x, RAX);
+				break;
+			case Op::OP_8xyE:
+				emit.aluByte(MOV_BYTE, RAX, x);
+				emit.shiftByte(EXT_SHR, RAX, 7);
+				emit.aluByte(MOV_BYTE, host[VF], RAX);
+				emit.shiftByte(EXT_SHL, x, 1);
+				break;
+			case Op::OP_Annn:
+				emit.movImm(host[INDEX], instruction.nnn);
+				break;
+			case Op::OP_Fx1E:
+				emit.movzxByte(RAX, x);
+				emit.add32(host[INDEX], RAX);
+				emit.and32Imm(host[INDEX], 0xFFFF);
+				break;
+			case Op::OP_Fx29:
+				emit.movzxByte(RAX, x);
+				emit.imulEaxImm(5);
+				emit.add32Imm(RAX, FONTSET_START_ADDRESS);
+				emit.mov32(host[INDEX], RAX);
+				break;
+			default:
+				break;
+		}
+	}
+
+	// Jumps and skips leave the next program counter in EAX
+	if (!terminates(instructions[length - 1].op)) {
+		emit.movImm(RAX, pc);
+	}
+	emit.storeWord(pcOffset, RAX);
+	emit.storeWordImm(opcodeOffset, instructions[length - 1].opcode);
+	for (unsigned i = 0; i < 16; i++) {
+		if (used & (1u << i)) {
+			emit.storeByte(registersOffset + i, host[i]);
+		}
+	}
+	if (used & (1u << INDEX)) {
+		emit.storeWord(indexOffset, host[INDEX]);
+	}
+
+	for (int i = sizeof(CALLEE_SAVED) - 1; i >= 0; i--) {
+		emit.pop(CALLEE_SAVED[i]);
+	}
+	emit.ret();
+
+#ifdef _WIN32
+	VirtualProtect(arena, ARENA_SIZE, PAGE_EXECUTE_READ, &oldProtection);
+	FlushInstructionCache(GetCurrentProcess(), arena + arenaUsed, emit.size());
+#else
+	mprotect(arena, ARENA_SIZE, PROT_READ | PROT_EXEC);
+#endif
+
+	block.code = reinterpret_cast<BlockCode>(arena + arenaUsed);
+	arenaUsed += (emit.size() + 15) & ~15u;
+	return block;
+#else
+	return blocks[address];
+#endif
+}
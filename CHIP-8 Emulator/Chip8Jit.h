@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Chip8.h"
+
+// Optional x86-64 backend that translates straight-line runs of CHIP-8
+// instructions into native code. Anything it cannot translate is handed to
+// Chip8::cycle(), so run() always matches the reference interpreter. On other
+// architectures run() simply forwards to Chip8::runBatch().
+class Chip8Jit {
+public:
+	Chip8Jit(Chip8& chip8);
+	~Chip8Jit();
+
+	void run(unsigned count);
+	void runFrame();
+	void flush();
+
+private:
+	typedef void (*BlockCode)(Chip8* chip8);
+
+	struct Block {
+		BlockCode code;
+		uint16_t start;
+		uint16_t end;
+		uint16_t length;
+		bool valid;
+	};
+
+	static const unsigned PAGE_SHIFT = 8;
+	static const unsigned PAGE_COUNT = MEMORY_SIZE >> PAGE_SHIFT;
+	static const unsigned ARENA_SIZE = 1 << 20;
+	static const unsigned MAX_BLOCK_LENGTH = 64;
+	static const unsigned MAX_BLOCK_BYTES = 2048;
+
+	Chip8& chip8;
+	uint8_t* arena;
+	unsigned arenaUsed;
+	Block blocks[MEMORY_SIZE];
+	std::vector<uint16_t> pageBlocks[PAGE_COUNT];
+
+	Block& compile(uint16_t address);
+	void invalidatePages(uint16_t pages);
+};
@@ -0,0 +1,133 @@
+#include "Input.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// The usual layout, with the keypad on the left of a QWERTY keyboard:
+//   1 2 3 C      1 2 3 4
+//   4 5 6 D  ->  Q W E R
+//   7 8 9 E      A S D F
+//   A 0 B F      Z X C V
+// Scancodes name physical keys, so the keypad stays in place on other layouts.
+static const SDL_Scancode DEFAULT_KEYMAP[16] = {
+	SDL_SCANCODE_X,
+	SDL_SCANCODE_1,
+	SDL_SCANCODE_2,
+	SDL_SCANCODE_3,
+	SDL_SCANCODE_Q,
+	SDL_SCANCODE_W,
+	SDL_SCANCODE_E,
+	SDL_SCANCODE_A,
+	SDL_SCANCODE_S,
+	SDL_SCANCODE_D,
+	SDL_SCANCODE_Z,
+	SDL_SCANCODE_C,
+	SDL_SCANCODE_4,
+	SDL_SCANCODE_R,
+	SDL_SCANCODE_F,
+	SDL_SCANCODE_V,
+};
+
+Input::Input() : state(0) {
+	std::fill(keymap, keymap + SDL_NUM_SCANCODES, NO_KEY);
+	for (uint8_t key = 0; key < 16; key++) {
+		bind(DEFAULT_KEYMAP[key], key);
+	}
+}
+
+void Input::bind(SDL_Scancode scancode, uint8_t key) {
+	if (scancode > SDL_SCANCODE_UNKNOWN && scancode < SDL_NUM_SCANCODES && key < 16) {
+		keymap[scancode] = key;
+	}
+}
+
+void Input::unbind(SDL_Scancode scancode) {
+	if (scancode > SDL_SCANCODE_UNKNOWN && scancode < SDL_NUM_SCANCODES) {
+		keymap[scancode] = NO_KEY;
+	}
+}
+
+// Replaces the bindings with "<key in hex> <SDL scancode name>" lines, such as
+// "5 W" or "0 Keypad 0"; blank lines and lines starting with '#' are ignored.
+// Leaves the bindings alone if the file can't be read.
+bool Input::loadKeymap(const char* filename) {
+	std::ifstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open keymap " << filename << std::endl;
+		return false;
+	}
+
+	uint8_t loaded[SDL_NUM_SCANCODES];
+	std::fill(loaded, loaded + SDL_NUM_SCANCODES, NO_KEY);
+
+	std::string line;
+	unsigned lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		unsigned key = NO_KEY;
+		std::string name;
+		SDL_Scancode scancode = SDL_SCANCODE_UNKNOWN;
+		if ((fields >> std::hex >> key >> std::ws) && std::getline(fields, name)) {
+			name.erase(name.find_last_not_of(" \t\r") + 1);
+			scancode = SDL_GetScancodeFromName(name.c_str());
+		}
+		if (key > 0xF || scancode == SDL_SCANCODE_UNKNOWN) {
+			std::cerr << filename << ":" << lineNumber << ": expected \"<key> <scancode name>\"" << std::endl;
+			return false;
+		}
+		loaded[scancode] = static_cast<uint8_t>(key);
+	}
+
+	std::copy(loaded, loaded + SDL_NUM_SCANCODES, keymap);
+	return true;
+}
+
+// The keypad key a host key is bound to, or NO_KEY
+uint8_t Input::keyFor(SDL_Scancode scancode) const {
+	if (static_cast<unsigned>(scancode) >= SDL_NUM_SCANCODES) {
+		return NO_KEY;
+	}
+	return keymap[scancode];
+}
+
+// Updates the keypad for a bound key and returns which keypad key it is, or
+// NO_KEY for keys that aren't bound so the caller can handle them itself.
+// Publishing is a release, so whatever the event thread stored before calling
+// this, such as a press time, is visible to the emulation thread once latch()
+// sees the key.
+uint8_t Input::handleKey(const SDL_KeyboardEvent& event) {
+	uint8_t key = keyFor(event.keysym.scancode);
+	if (key == NO_KEY) {
+		return NO_KEY;
+	}
+
+	uint32_t bit = 1u << key;
+	if (event.type == SDL_KEYDOWN) {
+		// Auto-repeat doesn't change what is held
+		if (!event.repeat) {
+			state.fetch_or(bit | (bit << 16), std::memory_order_release);
+		}
+	}
+	else {
+		state.fetch_and(~bit, std::memory_order_release);
+	}
+	return key;
+}
+
+// Returns the keypad state for the frame about to run: the keys held now, plus
+// any pressed and released again since the last call. pressed, when given,
+// receives the keys pressed since the last call.
+uint16_t Input::latch(uint16_t* pressed) {
+	uint32_t word = state.fetch_and(0xFFFF, std::memory_order_acquire);
+	if (pressed) {
+		*pressed = static_cast<uint16_t>(word >> 16);
+	}
+	return static_cast<uint16_t>(word | (word >> 16));
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "SDL.h"
+
+// Keymap entry for a scancode that isn't bound to any keypad key
+const uint8_t NO_KEY = 0xFF;
+
+// Maps host keys to the 16-key keypad through a remappable scancode table and
+// keeps the keypad in one atomic word. The event thread updates it as keys
+// change; the emulation thread reads it with latch() between frames, so the
+// machine sees the keypad change only at frame boundaries.
+class Input {
+public:
+	Input();
+
+	void bind(SDL_Scancode scancode, uint8_t key);
+	void unbind(SDL_Scancode scancode);
+	bool loadKeymap(const char* filename);
+
+	uint8_t keyFor(SDL_Scancode scancode) const;
+	uint8_t handleKey(const SDL_KeyboardEvent& event);
+	uint16_t latch(uint16_t* pressed = nullptr);
+private:
+	uint8_t keymap[SDL_NUM_SCANCODES];
+	// Low 16 bits: keys held. High 16 bits: keys pressed since the last latch(),
+	// which keeps a tap that starts and ends between two frames visible to one.
+	std::atomic<uint32_t> state;
+};
@@ -0,0 +1,221 @@
+#include "LatencyTracer.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+	const double BUCKET_MS = 0.1;
+	const unsigned BUCKET_COUNT = 2500;
+
+	// Longest a press is followed before it's assumed the ROM ignored it
+	const std::chrono::seconds TRACE_TIMEOUT(1);
+
+	const char* const STAGE_NAMES[] = { "latch", "read", "draw", "present", "total" };
+	static_assert(sizeof(STAGE_NAMES) / sizeof(STAGE_NAMES[0]) == static_cast<int>(LatencyStage::COUNT),
+		"stage names out of sync with LatencyStage");
+
+	double milliseconds(std::chrono::steady_clock::duration duration) {
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+}
+
+LatencyHistogram::LatencyHistogram() : counts(BUCKET_COUNT, 0), total(0), maxMs(0) {
+}
+
+void LatencyHistogram::add(double ms) {
+	unsigned bucket = ms > 0 ? static_cast<unsigned>(ms / BUCKET_MS) : 0;
+	counts[std::min(bucket, BUCKET_COUNT - 1)]++;
+	total++;
+	maxMs = std::max(maxMs, ms);
+}
+
+// The upper edge of the bucket holding the sample at fraction (0-1) of the way
+// through the sorted samples, or 0 with no samples
+double LatencyHistogram::percentile(double fraction) const {
+	if (total == 0) {
+		return 0;
+	}
+
+	uint64_t rank = static_cast<uint64_t>(fraction * total);
+	uint64_t seen = 0;
+	for (unsigned bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+		seen += counts[bucket];
+		if (seen > rank) {
+			return std::min((bucket + 1) * BUCKET_MS, maxMs);
+		}
+	}
+	return maxMs;
+}
+
+uint64_t LatencyHistogram::count() const {
+	return total;
+}
+
+double LatencyHistogram::max() const {
+	return maxMs;
+}
+
+const std::vector<uint32_t>& LatencyHistogram::buckets() const {
+	return counts;
+}
+
+LatencyTracer::LatencyTracer() : presentSequence(0), presentTime(0), presentedFrame(0) {
+	for (std::atomic<Clock::rep>& time : pressTimes) {
+		time.store(0, std::memory_order_relaxed);
+	}
+}
+
+// Event thread: a bound key went down in processInput. Called before Input
+// publishes the key, whose release and acquire order this relaxed store for
+// latched().
+void LatencyTracer::keyPressed(uint8_t key, Clock::time_point time) {
+	pressTimes[key & 0xF].store(time.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+// Event thread: SDL_RenderPresent returned with frame on screen. Only the first
+// present of a frame counts; phosphor fades present the same frame again.
+void LatencyTracer::presented(uint64_t frame, Clock::time_point time) {
+	if (frame == lastPresented) {
+		return;
+	}
+	lastPresented = frame;
+
+	// The release stores keep the odd sequence ahead of the values for collect()
+	uint32_t sequence = presentSequence.load(std::memory_order_relaxed);
+	presentSequence.store(sequence + 1, std::memory_order_relaxed);
+	presentTime.store(time.time_since_epoch().count(), std::memory_order_release);
+	presentedFrame.store(frame, std::memory_order_release);
+	presentSequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Input::latch() delivered the keys in pressed to the machine
+void LatencyTracer::latched(uint16_t pressed, Clock::time_point time) {
+	for (uint8_t key = 0; pressed; key++, pressed >>= 1) {
+		if (pressed & 1) {
+			Trace trace = {};
+			trace.times[0] = Clock::time_point(Clock::duration(pressTimes[key].load(std::memory_order_relaxed)));
+			trace.times[1] = time;
+			trace.reached = 2;
+			traces.push_back(trace);
+		}
+	}
+	expire(time);
+}
+
+// Called before and after each frame the machine runs, to catch the frame that
+// reads the keypad and the one that then changes the display
+void LatencyTracer::beforeFrame(const Chip8& chip8) {
+	collect();
+	watching = std::any_of(traces.begin(), traces.end(), [](const Trace& trace) {
+		return trace.reached == 2 || trace.reached == 3;
+	});
+	if (watching) {
+		keypadReads = chip8.keypadReads;
+		videoHash = chip8.hashVideo();
+	}
+}
+
+void LatencyTracer::afterFrame(const Chip8& chip8, uint64_t frame, Clock::time_point time) {
+	if (watching) {
+		if (chip8.keypadReads != keypadReads) {
+			advance(2, time, frame);
+		}
+		if (chip8.hashVideo() != videoHash) {
+			advance(3, time, frame);
+		}
+		watching = false;
+	}
+	expire(time);
+}
+
+// Completes the presses whose change on screen has been presented. A present
+// caught half written is left for the next call.
+void LatencyTracer::collect() {
+	uint32_t sequence = presentSequence.load(std::memory_order_acquire);
+	uint64_t frame = presentedFrame.load(std::memory_order_acquire);
+	Clock::time_point time(Clock::duration(presentTime.load(std::memory_order_acquire)));
+	if ((sequence & 1) || presentSequence.load(std::memory_order_relaxed) != sequence) {
+		return;
+	}
+
+	while (!traces.empty() && traces.front().reached == 4 && traces.front().frame <= frame) {
+		Trace& trace = traces.front();
+		trace.times[4] = time;
+		for (int stage = 0; stage < static_cast<int>(LatencyStage::TOTAL); stage++) {
+			histograms[stage].add(milliseconds(trace.times[stage + 1] - trace.times[stage]));
+		}
+		histograms[static_cast<int>(LatencyStage::TOTAL)].add(milliseconds(trace.times[4] - trace.times[0]));
+		traces.pop_front();
+	}
+}
+
+const LatencyHistogram& LatencyTracer::histogram(LatencyStage stage) const {
+	return histograms[static_cast<int>(stage)];
+}
+
+uint64_t LatencyTracer::dropped() const {
+	return droppedTraces;
+}
+
+void LatencyTracer::advance(unsigned from, Clock::time_point time, uint64_t frame) {
+	for (Trace& trace : traces) {
+		if (trace.reached == from) {
+			trace.times[from] = time;
+			trace.reached = from + 1;
+			trace.frame = frame;
+		}
+	}
+}
+
+void LatencyTracer::expire(Clock::time_point time) {
+	while (!traces.empty() && time - traces.front().times[0] > TRACE_TIMEOUT) {
+		traces.pop_front();
+		droppedTraces++;
+	}
+}
+
+void LatencyTracer::writeSummary(std::ostream& out) const {
+	char line[160];
+	for (int stage = 0; stage < static_cast<int>(LatencyStage::COUNT); stage++) {
+		const LatencyHistogram& histogram = histograms[stage];
+		std::snprintf(line, sizeof(line), "%-8s %6llu presses  p50 %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f ms\n",
+			STAGE_NAMES[stage], static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.5),
+			histogram.percentile(0.9), histogram.percentile(0.99), histogram.max());
+		out << line;
+	}
+	out << droppedTraces << " presses dropped without a visible response" << std::endl;
+}
+
+// Percentiles per stage, and the non-empty buckets as [upper edge in ms, count]
+void LatencyTracer::writeJson(std::ostream& out) const {
+	out << "{\n";
+	out << "  \"bucket_ms\": " << BUCKET_MS << ",\n";
+	out << "  \"dropped\": " << droppedTraces << ",\n";
+	out << "  \"stages\": [";
+
+	for (int stage = 0; stage < static_cast<int>(LatencyStage::COUNT); stage++) {
+		const LatencyHistogram& histogram = histograms[stage];
+		char numbers[192];
+		std::snprintf(numbers, sizeof(numbers),
+			"\"p50_ms\": %.1f, \"p90_ms\": %.1f, \"p99_ms\": %.1f, \"p999_ms\": %.1f, \"max_ms\": %.3f",
+			histogram.percentile(0.5), histogram.percentile(0.9), histogram.percentile(0.99),
+			histogram.percentile(0.999), histogram.max());
+
+		out << (stage ? ",\n" : "\n");
+		out << "    {\"stage\": \"" << STAGE_NAMES[stage] << "\", \"count\": " << histogram.count() << ", " << numbers
+			<< ", \"histogram\": [";
+
+		const std::vector<uint32_t>& buckets = histogram.buckets();
+		bool first = true;
+		for (unsigned bucket = 0; bucket < buckets.size(); bucket++) {
+			if (buckets[bucket]) {
+				char entry[48];
+				std::snprintf(entry, sizeof(entry), "%s[%.1f, %u]", first ? "" : ", ", (bucket + 1) * BUCKET_MS, buckets[bucket]);
+				out << entry;
+				first = false;
+			}
+		}
+		out << "]}";
+	}
+
+	out << "\n  ]\n}\n";
+}
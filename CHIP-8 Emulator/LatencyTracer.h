@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <vector>
+
+#include "Chip8.h"
+
+// The steps a key press takes from the keyboard to the screen, each timed from
+// the end of the one before
+enum class LatencyStage : uint8_t {
+	LATCH,   // seen by processInput, until latched into the machine between frames
+	READ,    // until the end of the first frame that ran Ex9E, ExA1 or Fx0A
+	DRAW,    // until the end of the first frame after that which changed video
+	PRESENT, // until SDL_RenderPresent returned with that frame or a later one
+	TOTAL,   // all of the above
+	COUNT
+};
+
+// Sample counts in 0.1 ms buckets up to 250 ms; slower samples land in the last
+class LatencyHistogram {
+public:
+	LatencyHistogram();
+
+	void add(double ms);
+	double percentile(double fraction) const;
+	uint64_t count() const;
+	double max() const;
+	const std::vector<uint32_t>& buckets() const;
+private:
+	std::vector<uint32_t> counts;
+	uint64_t total;
+	double maxMs;
+};
+
+// Follows key presses through the frontend and records how long each stage took.
+// Presses that the ROM never reads or never answers with a change on screen are
+// dropped after a second. keyPressed() and presented() are called on the event
+// thread and pass their times over through atomics; everything else, including
+// reading the results, belongs to the emulation thread.
+class LatencyTracer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	LatencyTracer();
+
+	void keyPressed(uint8_t key, Clock::time_point time);
+	void presented(uint64_t frame, Clock::time_point time);
+
+	void latched(uint16_t pressed, Clock::time_point time);
+	void beforeFrame(const Chip8& chip8);
+	void afterFrame(const Chip8& chip8, uint64_t frame, Clock::time_point time);
+	void collect();
+
+	const LatencyHistogram& histogram(LatencyStage stage) const;
+	uint64_t dropped() const;
+
+	void writeSummary(std::ostream& out) const;
+	void writeJson(std::ostream& out) const;
+private:
+	// times[n] is when the press reached stage n, where stage 0 is the key event
+	struct Trace {
+		Clock::time_point times[static_cast<int>(LatencyStage::TOTAL) + 1];
+		unsigned reached;
+		// The frame whose change on screen completes the trace once presented
+		uint64_t frame;
+	};
+
+	void advance(unsigned from, Clock::time_point time, uint64_t frame);
+	void expire(Clock::time_point time);
+
+	// Set by the event thread. presentSequence is odd while presentTime and
+	// presentedFrame are being written, so a frame is never paired with the time
+	// of another.
+	std::atomic<Clock::rep> pressTimes[16];
+	std::atomic<uint32_t> presentSequence;
+	std::atomic<Clock::rep> presentTime;
+	std::atomic<uint64_t> presentedFrame;
+	// Event thread only
+	uint64_t lastPresented = 0;
+
+	// Oldest first; an older press is never at an earlier stage than a newer one
+	std::deque<Trace> traces;
+	LatencyHistogram histograms[static_cast<int>(LatencyStage::COUNT)];
+	uint64_t droppedTraces = 0;
+
+	bool watching = false;
+	uint32_t keypadReads = 0;
+	uint64_t videoHash = 0;
+};
@@ -0,0 +1,120 @@
+#include "Movie.h"
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// Movie files are a little-endian header followed by the frames as runs of a
+// 16-bit keypad state and a 16-bit repeat count, so long stretches without
+// input take four bytes.
+namespace {
+	const uint32_t MOVIE_MAGIC = 0x564D3843; // "C8MV"
+	const uint16_t MOVIE_VERSION = 1;
+	const size_t MAX_RUN = 0xFFFF;
+
+	void put(std::vector<uint8_t>& out, uint32_t value, int bytes) {
+		for (int i = 0; i < bytes; i++) {
+			out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+		}
+	}
+
+	uint32_t get(const uint8_t* in, int bytes) {
+		uint32_t value = 0;
+		for (int i = 0; i < bytes; i++) {
+			value |= static_cast<uint32_t>(in[i]) << (8 * i);
+		}
+		return value;
+	}
+}
+
+// Seeds the machine and sets its frame length; call right after loading the ROM
+void Movie::start(Chip8& chip8) const {
+	chip8.randomGen.seed(seed);
+	chip8.cyclesPerFrame = cyclesPerFrame;
+}
+
+// Appends the keys the machine is about to run the next frame with
+void Movie::record(const Chip8& chip8) {
+	frames.push_back(chip8.keys);
+}
+
+// Sets the keys for a frame. Returns false once the movie has run out.
+bool Movie::play(Chip8& chip8, size_t frame) const {
+	if (frame >= frames.size()) {
+		return false;
+	}
+
+	chip8.keys = frames[frame];
+	return true;
+}
+
+// Returns false if the file can't be written or cyclesPerFrame doesn't fit its
+// 16-bit field
+bool Movie::save(const char* filename) const {
+	if (cyclesPerFrame == 0 || cyclesPerFrame > 0xFFFF) {
+		std::cerr << "Movie files hold 1 to 65535 cycles per frame, not " << cyclesPerFrame << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	put(data, MOVIE_MAGIC, 4);
+	put(data, MOVIE_VERSION, 2);
+	put(data, cyclesPerFrame, 2);
+	put(data, seed, 4);
+	put(data, static_cast<uint32_t>(frames.size()), 4);
+
+	for (size_t i = 0; i < frames.size();) {
+		size_t count = 1;
+		while (i + count < frames.size() && count < MAX_RUN && frames[i + count] == frames[i]) {
+			count++;
+		}
+		put(data, frames[i], 2);
+		put(data, static_cast<uint32_t>(count), 2);
+		i += count;
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open movie file!" << std::endl;
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+	return file.good();
+}
+
+// Returns false, leaving the movie unchanged, if the file is missing or malformed
+bool Movie::load(const char* filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open movie file!" << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const size_t HEADER_SIZE = 16;
+	if (data.size() < HEADER_SIZE || get(&data[0], 4) != MOVIE_MAGIC || get(&data[4], 2) != MOVIE_VERSION) {
+		std::cerr << "Not a movie file!" << std::endl;
+		return false;
+	}
+
+	// Check the header's frame count against the runs before allocating for it
+	uint32_t frameCount = get(&data[12], 4);
+	uint64_t runFrames = 0;
+	for (size_t offset = HEADER_SIZE; offset + 4 <= data.size(); offset += 4) {
+		runFrames += get(&data[offset + 2], 2);
+	}
+	if (runFrames != frameCount || get(&data[6], 2) == 0) {
+		std::cerr << "Movie file is corrupt!" << std::endl;
+		return false;
+	}
+
+	std::vector<uint16_t> loaded;
+	loaded.reserve(frameCount);
+	for (size_t offset = HEADER_SIZE; offset + 4 <= data.size(); offset += 4) {
+		loaded.insert(loaded.end(), get(&data[offset + 2], 2), static_cast<uint16_t>(get(&data[offset], 2)));
+	}
+
+	cyclesPerFrame = get(&data[6], 2);
+	seed = get(&data[8], 4);
+	frames.swap(loaded);
+	return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Chip8.h"
+
+// Input recording: the random seed, the instructions per frame and the keypad
+// state of every frame. Started on a freshly loaded ROM, playing it back
+// reproduces the recorded run exactly.
+class Movie {
+public:
+	uint32_t seed = 0;
+	unsigned cyclesPerFrame = 10;
+	// Keypad state per frame, one bit per key
+	std::vector<uint16_t> frames;
+
+	void start(Chip8& chip8) const;
+	void record(const Chip8& chip8);
+	bool play(Chip8& chip8, size_t frame) const;
+
+	bool save(const char* filename) const;
+	bool load(const char* filename);
+};
@@ -0,0 +1,159 @@
+#include "PostProcess.h"
+#include <algorithm>
+#include <cstring>
+#include "SDL.h"
+
+namespace {
+	// Brightness of normal rows and of the dimmed rows between scanlines, out of 256
+	const unsigned FULL_SHADE = 256;
+	const unsigned SCANLINE_SHADE = 160;
+
+	static_assert(VIDEO_WIDTH % 32 == 0, "kernels work on rows of whole 32 pixel blocks");
+
+	void decayScalar(uint8_t* intensity, const uint8_t* lit, unsigned count, unsigned keep) {
+		for (unsigned i = 0; i < count; i++) {
+			intensity[i] = std::max(lit[i], static_cast<uint8_t>((intensity[i] * keep) >> 8));
+		}
+	}
+
+	void scale2xScalar(const uint8_t* above, const uint8_t* row, const uint8_t* below, unsigned width,
+		uint8_t* top, uint8_t* bottom) {
+		for (unsigned x = 0; x < width; x++) {
+			uint8_t b = above[x], d = (row + x)[-1], e = row[x], f = row[x + 1], h = below[x];
+			top[2 * x] = d == b && b != f && d != h ? d : e;
+			top[2 * x + 1] = b == f && b != d && f != h ? f : e;
+			bottom[2 * x] = d == h && d != b && h != f ? d : e;
+			bottom[2 * x + 1] = h == f && d != h && b != f ? f : e;
+		}
+	}
+
+	void expandRowScalar(const uint8_t* intensity, unsigned width, unsigned scale, unsigned shade, uint32_t* pixels) {
+		for (unsigned x = 0; x < width; x++) {
+			uint32_t level = (intensity[x] * shade) >> 8;
+			uint32_t pixel = level * 0x01010100u | 0xFF;
+			for (unsigned i = 0; i < scale; i++) {
+				*pixels++ = pixel;
+			}
+		}
+	}
+
+	const PostKernels SCALAR_KERNELS = { decayScalar, scale2xScalar, expandRowScalar };
+
+	const PostKernels* selectKernels() {
+		const PostKernels* kernels = avx2PostKernels();
+		if (kernels && SDL_HasAVX2()) {
+			return kernels;
+		}
+		kernels = sse2PostKernels();
+		if (kernels && SDL_HasSSE2()) {
+			return kernels;
+		}
+		return &SCALAR_KERNELS;
+	}
+}
+
+PostProcessor::PostProcessor(const PostProcessSettings& settings)
+	: kernels(selectKernels()), settings(settings), outputScale(1), decaying(false) {
+	float persistence = std::min(std::max(settings.persistence, 0.0f), 1.0f);
+	keep = std::min(static_cast<unsigned>(persistence * 256), 255u);
+	std::memset(intensity, 0, sizeof(intensity));
+	setScale(settings.scale ? settings.scale : 1);
+}
+
+// Advances the phosphors one displayed frame: lit pixels go to full brightness
+// and the rest fade. Returns the rows whose brightness changed.
+uint32_t PostProcessor::step(const uint64_t* video) {
+	uint32_t rows = 0;
+	for (unsigned row = 0; row < VIDEO_HEIGHT; row++) {
+		uint64_t bits = video[row];
+		for (unsigned column = 0; column < VIDEO_WIDTH; column++) {
+			lit[column] = 0u - static_cast<uint8_t>((bits >> (VIDEO_WIDTH - 1 - column)) & 1);
+		}
+
+		uint8_t* line = &intensity[row + 1][1];
+		uint8_t before[VIDEO_WIDTH];
+		std::memcpy(before, line, VIDEO_WIDTH);
+		kernels->decay(line, lit, VIDEO_WIDTH, keep);
+		if (std::memcmp(before, line, VIDEO_WIDTH) != 0) {
+			rows |= 1u << row;
+			line[-1] = line[0];
+			line[VIDEO_WIDTH] = line[VIDEO_WIDTH - 1];
+		}
+	}
+
+	std::memcpy(intensity[0], intensity[1], ROW_STRIDE);
+	std::memcpy(intensity[VIDEO_HEIGHT + 1], intensity[VIDEO_HEIGHT], ROW_STRIDE);
+
+	// A step that changed nothing means every pixel has settled at 0 or 255
+	decaying = rows != 0 && keep != 0;
+	return rows;
+}
+
+// True while pixels are still fading, so step() has to keep being called at the
+// frame rate even though the display hasn't changed
+bool PostProcessor::fading() const {
+	return decaying;
+}
+
+// Scale2x doubles first, so with it the scale is rounded down to an even number
+void PostProcessor::setScale(int scale) {
+	outputScale = std::max(scale, 1);
+	if (settings.scale2x) {
+		outputScale = std::max(outputScale & ~1, 2);
+	}
+}
+
+int PostProcessor::scale() const {
+	return outputScale;
+}
+
+int PostProcessor::outputWidth() const {
+	return VIDEO_WIDTH * outputScale;
+}
+
+int PostProcessor::outputHeight() const {
+	return VIDEO_HEIGHT * outputScale;
+}
+
+// Whether a changed row also changes the output of the rows next to it
+bool PostProcessor::readsNeighbours() const {
+	return settings.scale2x;
+}
+
+// Whether any filter changes more than the brightness of whole CHIP-8 pixels
+bool PostProcessor::needsOutputResolution() const {
+	return settings.scanlines || settings.scale2x;
+}
+
+// Writes the output rows for display rows firstRow to lastRow, the first of them
+// at pixels
+void PostProcessor::render(unsigned firstRow, unsigned lastRow, uint8_t* pixels, int pitch) {
+	for (unsigned row = firstRow; row <= lastRow; row++) {
+		const uint8_t* line = &intensity[row + 1][1];
+		if (settings.scale2x) {
+			kernels->scale2x(line - ROW_STRIDE, line, line + ROW_STRIDE, VIDEO_WIDTH, doubled[0], doubled[1]);
+			pixels = emitRows(doubled[0], VIDEO_WIDTH * 2, outputScale / 2, pixels, pitch);
+			pixels = emitRows(doubled[1], VIDEO_WIDTH * 2, outputScale / 2, pixels, pitch);
+		}
+		else {
+			pixels = emitRows(line, VIDEO_WIDTH, outputScale, pixels, pitch);
+		}
+	}
+}
+
+// Writes factor output rows for a row of intensities, the last third of them
+// dimmed with scanlines on. Rows after the first of each shade are copies.
+uint8_t* PostProcessor::emitRows(const uint8_t* line, unsigned width, unsigned factor, uint8_t* pixels, int pitch) {
+	unsigned dimRows = settings.scanlines ? (factor + 1) / 3 : 0;
+	size_t rowBytes = width * factor * sizeof(uint32_t);
+
+	for (unsigned i = 0; i < factor; i++, pixels += pitch) {
+		if (i == 0 || i == factor - dimRows) {
+			kernels->expandRow(line, width, factor, i == 0 ? FULL_SHADE : SCANLINE_SHADE, reinterpret_cast<uint32_t*>(pixels));
+		}
+		else {
+			std::memcpy(pixels, pixels - pitch, rowBytes);
+		}
+	}
+	return pixels;
+}
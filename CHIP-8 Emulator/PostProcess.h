@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+
+#include "Chip8.h"
+#include "PostProcessKernels.h"
+
+struct PostProcessSettings {
+	// Share of a pixel's brightness kept from one displayed frame to the next, so
+	// sprites erased and redrawn every frame glow instead of flickering. 0 turns
+	// phosphor decay off.
+	float persistence = 0.5f;
+	// Output pixels per CHIP-8 pixel, or 0 to pick the largest that fits the window
+	int scale = 0;
+	bool scanlines = false;
+	bool scale2x = false;
+};
+
+// Turns the packed display into RGBA8888 pixels on the CPU: phosphor decay at
+// CHIP-8 resolution, then optionally Scale2x, then integer scaling with optional
+// scanlines. The kernels are picked at startup for the best instruction set the
+// CPU has.
+class PostProcessor {
+public:
+	PostProcessor(const PostProcessSettings& settings);
+
+	uint32_t step(const uint64_t* video);
+	bool fading() const;
+
+	void setScale(int scale);
+	int scale() const;
+	int outputWidth() const;
+	int outputHeight() const;
+	bool readsNeighbours() const;
+	bool needsOutputResolution() const;
+
+	void render(unsigned firstRow, unsigned lastRow, uint8_t* pixels, int pitch);
+private:
+	// Intensity rows carry a border pixel either side and a border row above and
+	// below, copies of the edge, for Scale2x to read past the display's edges
+	static const unsigned ROW_STRIDE = VIDEO_WIDTH + 2;
+
+	uint8_t* emitRows(const uint8_t* intensity, unsigned width, unsigned factor, uint8_t* pixels, int pitch);
+
+	const PostKernels* kernels;
+	PostProcessSettings settings;
+	unsigned keep;
+	int outputScale;
+	bool decaying;
+
+	uint8_t intensity[VIDEO_HEIGHT + 2][ROW_STRIDE];
+	uint8_t lit[VIDEO_WIDTH];
+	uint8_t doubled[2][VIDEO_WIDTH * 2];
+};
@@ -0,0 +1,117 @@
+#include "PostProcessKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CHIP8_POST_AVX2
+#endif
+
+#ifdef CHIP8_POST_AVX2
+#include <immintrin.h>
+
+// Only these functions may use AVX2, and they only run once the CPU says it has
+// it. The file is built with the project's normal flags rather than -mavx2 so
+// nothing else in it, inline library code included, can pick up AVX2 instructions.
+// MSVC allows the intrinsics without any of this.
+#if defined(__GNUC__)
+#define CHIP8_AVX2 __attribute__((target("avx2")))
+#else
+#define CHIP8_AVX2
+#endif
+
+namespace {
+	CHIP8_AVX2 inline __m256i select(__m256i mask, __m256i ifSet, __m256i ifClear) {
+		return _mm256_blendv_epi8(ifClear, ifSet, mask);
+	}
+
+	CHIP8_AVX2 void decayAvx2(uint8_t* intensity, const uint8_t* lit, unsigned count, unsigned keep) {
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i factor = _mm256_set1_epi16(static_cast<short>(keep));
+		for (unsigned i = 0; i < count; i += 32) {
+			__m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(intensity + i));
+			// Unpacking and packing both work within 128-bit lanes, so the order survives
+			__m256i low = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(current, zero), factor), 8);
+			__m256i high = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(current, zero), factor), 8);
+			__m256i faded = _mm256_packus_epi16(low, high);
+			__m256i on = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lit + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(intensity + i), _mm256_max_epu8(faded, on));
+		}
+	}
+
+	// Interleaves the bytes of left and right across the full 256 bits, where the
+	// unpack instructions only interleave within each 128-bit lane
+	CHIP8_AVX2 inline void storeInterleaved(uint8_t* out, __m256i left, __m256i right) {
+		__m256i low = _mm256_unpacklo_epi8(left, right);
+		__m256i high = _mm256_unpackhi_epi8(left, right);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute2x128_si256(low, high, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), _mm256_permute2x128_si256(low, high, 0x31));
+	}
+
+	CHIP8_AVX2 void scale2xAvx2(const uint8_t* above, const uint8_t* row, const uint8_t* below, unsigned width,
+		uint8_t* top, uint8_t* bottom) {
+		for (unsigned x = 0; x < width; x += 32) {
+			__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(above + x));
+			__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x - 1));
+			__m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+			__m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x + 1));
+			__m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(below + x));
+
+			__m256i db = _mm256_cmpeq_epi8(d, b), bf = _mm256_cmpeq_epi8(b, f);
+			__m256i dh = _mm256_cmpeq_epi8(d, h), hf = _mm256_cmpeq_epi8(h, f);
+			__m256i e0 = select(_mm256_andnot_si256(_mm256_or_si256(bf, dh), db), d, e);
+			__m256i e1 = select(_mm256_andnot_si256(_mm256_or_si256(db, hf), bf), f, e);
+			__m256i e2 = select(_mm256_andnot_si256(_mm256_or_si256(db, hf), dh), d, e);
+			__m256i e3 = select(_mm256_andnot_si256(_mm256_or_si256(dh, bf), hf), f, e);
+
+			storeInterleaved(top + 2 * x, e0, e1);
+			storeInterleaved(bottom + 2 * x, e2, e3);
+		}
+	}
+
+	// Fills count pixels with the pixel in every lane of value
+	CHIP8_AVX2 inline uint32_t* fill(uint32_t* pixels, __m256i value, unsigned count) {
+		unsigned i = 0;
+		for (; i + 8 <= count; i += 8) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), value);
+		}
+		if (i + 4 <= count) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), _mm256_castsi256_si128(value));
+			i += 4;
+		}
+		for (; i < count; i++) {
+			pixels[i] = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(value)));
+		}
+		return pixels + count;
+	}
+
+	CHIP8_AVX2 void expandRowAvx2(const uint8_t* intensity, unsigned width, unsigned scale, unsigned shade, uint32_t* pixels) {
+		const __m256i factor = _mm256_set1_epi32(static_cast<int>(shade));
+		// Multiplying a level by this puts it in red, green and blue
+		const __m256i spread = _mm256_set1_epi32(0x01010100);
+		const __m256i alpha = _mm256_set1_epi32(0xFF);
+		for (unsigned x = 0; x < width; x += 8) {
+			__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(intensity + x));
+			__m256i level = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(bytes), factor), 8);
+			__m256i grey = _mm256_or_si256(_mm256_mullo_epi32(level, spread), alpha);
+
+			if (scale == 1) {
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels), grey);
+				pixels += 8;
+			}
+			else {
+				for (int lane = 0; lane < 8; lane++) {
+					pixels = fill(pixels, _mm256_permutevar8x32_epi32(grey, _mm256_set1_epi32(lane)), scale);
+				}
+			}
+		}
+	}
+
+	const PostKernels AVX2_KERNELS = { decayAvx2, scale2xAvx2, expandRowAvx2 };
+}
+
+const PostKernels* avx2PostKernels() {
+	return &AVX2_KERNELS;
+}
+#else
+const PostKernels* avx2PostKernels() {
+	return nullptr;
+}
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+
+// The per-row kernels behind PostProcessor, in scalar, SSE2 and AVX2 builds that
+// give identical results. Widths are multiples of 32. Intensities are bytes, 0
+// for off and 255 for fully lit.
+struct PostKernels {
+	// intensity = max(lit, intensity * keep / 256) over count bytes
+	void (*decay)(uint8_t* intensity, const uint8_t* lit, unsigned count, unsigned keep);
+
+	// Scale2x: writes the top and bottom output rows, 2 * width each, for row from
+	// it and its neighbours. All three rows have one valid byte before and after.
+	void (*scale2x)(const uint8_t* above, const uint8_t* row, const uint8_t* below, unsigned width,
+		uint8_t* top, uint8_t* bottom);
+
+	// Writes each intensity as scale grey RGBA8888 pixels at shade / 256 of its
+	// brightness, for shade up to 256
+	void (*expandRow)(const uint8_t* intensity, unsigned width, unsigned scale, unsigned shade, uint32_t* pixels);
+};
+
+// Null when the compiler or target can't build them
+const PostKernels* sse2PostKernels();
+const PostKernels* avx2PostKernels();
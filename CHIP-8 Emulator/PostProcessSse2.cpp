@@ -0,0 +1,100 @@
+#include "PostProcessKernels.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHIP8_POST_SSE2
+#endif
+
+#ifdef CHIP8_POST_SSE2
+#include <emmintrin.h>
+
+namespace {
+	inline __m128i select(__m128i mask, __m128i ifSet, __m128i ifClear) {
+		return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+	}
+
+	void decaySse2(uint8_t* intensity, const uint8_t* lit, unsigned count, unsigned keep) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i factor = _mm_set1_epi16(static_cast<short>(keep));
+		for (unsigned i = 0; i < count; i += 16) {
+			__m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(intensity + i));
+			__m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(current, zero), factor), 8);
+			__m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(current, zero), factor), 8);
+			__m128i faded = _mm_packus_epi16(low, high);
+			__m128i on = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lit + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(intensity + i), _mm_max_epu8(faded, on));
+		}
+	}
+
+	void scale2xSse2(const uint8_t* above, const uint8_t* row, const uint8_t* below, unsigned width,
+		uint8_t* top, uint8_t* bottom) {
+		for (unsigned x = 0; x < width; x += 16) {
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+			__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+			__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+			__m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+			__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+
+			__m128i db = _mm_cmpeq_epi8(d, b), bf = _mm_cmpeq_epi8(b, f);
+			__m128i dh = _mm_cmpeq_epi8(d, h), hf = _mm_cmpeq_epi8(h, f);
+			__m128i e0 = select(_mm_andnot_si128(_mm_or_si128(bf, dh), db), d, e);
+			__m128i e1 = select(_mm_andnot_si128(_mm_or_si128(db, hf), bf), f, e);
+			__m128i e2 = select(_mm_andnot_si128(_mm_or_si128(db, hf), dh), d, e);
+			__m128i e3 = select(_mm_andnot_si128(_mm_or_si128(dh, bf), hf), f, e);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(top + 2 * x), _mm_unpacklo_epi8(e0, e1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(top + 2 * x + 16), _mm_unpackhi_epi8(e0, e1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(bottom + 2 * x), _mm_unpacklo_epi8(e2, e3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(bottom + 2 * x + 16), _mm_unpackhi_epi8(e2, e3));
+		}
+	}
+
+	// Fills count pixels with the pixel in every lane of value
+	inline uint32_t* fill(uint32_t* pixels, __m128i value, unsigned count) {
+		unsigned i = 0;
+		for (; i + 4 <= count; i += 4) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), value);
+		}
+		for (; i < count; i++) {
+			pixels[i] = static_cast<uint32_t>(_mm_cvtsi128_si32(value));
+		}
+		return pixels + count;
+	}
+
+	void expandRowSse2(const uint8_t* intensity, unsigned width, unsigned scale, unsigned shade, uint32_t* pixels) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i factor = _mm_set1_epi16(static_cast<short>(shade));
+		const __m128i alpha = _mm_set1_epi32(0xFF);
+		for (unsigned x = 0; x < width; x += 4) {
+			int32_t packed;
+			std::memcpy(&packed, intensity + x, sizeof(packed));
+			__m128i words = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), factor), 8);
+			__m128i level = _mm_unpacklo_epi16(words, zero);
+			// Grey: the level in red, green and blue, opaque
+			__m128i grey = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(level, 24), _mm_slli_epi32(level, 16)),
+				_mm_or_si128(_mm_slli_epi32(level, 8), alpha));
+
+			if (scale == 1) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(pixels), grey);
+				pixels += 4;
+			}
+			else {
+				pixels = fill(pixels, _mm_shuffle_epi32(grey, 0x00), scale);
+				pixels = fill(pixels, _mm_shuffle_epi32(grey, 0x55), scale);
+				pixels = fill(pixels, _mm_shuffle_epi32(grey, 0xAA), scale);
+				pixels = fill(pixels, _mm_shuffle_epi32(grey, 0xFF), scale);
+			}
+		}
+	}
+
+	const PostKernels SSE2_KERNELS = { decaySse2, scale2xSse2, expandRowSse2 };
+}
+
+const PostKernels* sse2PostKernels() {
+	return &SSE2_KERNELS;
+}
+#else
+const PostKernels* sse2PostKernels() {
+	return nullptr;
+}
+#endif
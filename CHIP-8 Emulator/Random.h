@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+
+// Advances an xorshift32 state and returns its top byte. Shared by every engine
+// so a seed gives the same bytes everywhere.
+inline uint8_t xorshift32Byte(uint32_t& state) {
+	uint32_t x = state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	state = x;
+	return static_cast<uint8_t>(x >> 24);
+}
+
+// Spreads a seed over the whole state so nearby seeds give unrelated streams.
+// xorshift32 must never hold zero, which the mix maps elsewhere.
+inline uint32_t xorshift32Seed(uint32_t seed) {
+	uint32_t x = seed + 0x9E3779B9u;
+	x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+	x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+	x ^= x >> 16;
+	return x ? x : 0x9E3779B9u;
+}
+
+// Default random number generator: four bytes of plain state that save states
+// copy as is, and the same stream on every platform
+struct Xorshift32 {
+	uint32_t state;
+
+	void seed(uint32_t value) {
+		state = xorshift32Seed(value);
+	}
+
+	uint8_t nextByte() {
+		return xorshift32Byte(state);
+	}
+};
+
+// Replaces the built-in generator when set on Chip8::randomSource, for tests that
+// need scripted values or a different algorithm. Its state is not part of save
+// states.
+class RandomSource {
+public:
+	virtual ~RandomSource() {}
+	virtual uint8_t nextByte() = 0;
+};
@@ -0,0 +1,153 @@
+#include "RewindBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+// A delta is a list of runs, each a 16-bit count of unchanged bytes, a 16-bit
+// count of changed bytes and then the XOR of those bytes. A literal stretch only
+// ends at MIN_ZERO_RUN unchanged bytes, so isolated matches don't split it.
+namespace {
+	const size_t MIN_ZERO_RUN = 4;
+	const size_t MAX_RUN = 0xFFFF;
+
+	void putCount(std::vector<uint8_t>& out, size_t count) {
+		out.push_back(static_cast<uint8_t>(count));
+		out.push_back(static_cast<uint8_t>(count >> 8));
+	}
+
+	size_t getCount(const uint8_t* in) {
+		return in[0] | (in[1] << 8);
+	}
+}
+
+RewindBuffer::RewindBuffer(size_t capacity)
+	: ring(capacity), head(0) {
+}
+
+void RewindBuffer::clear() {
+	records.clear();
+	latest.clear();
+	head = 0;
+}
+
+// Number of frames rewind() can still step back
+size_t RewindBuffer::frames() const {
+	return records.size();
+}
+
+size_t RewindBuffer::bytesUsed() const {
+	size_t used = latest.size();
+	for (const Record& record : records) {
+		used += record.length;
+	}
+	return used;
+}
+
+// Records the machine's state at the end of a frame
+void RewindBuffer::push(const Chip8& chip8) {
+	current.resize(chip8.stateSize());
+	chip8.saveState(current.data(), current.size());
+
+	if (latest.size() == current.size()) {
+		encodeDelta(current.data(), latest.data(), current.size());
+		store(delta.data(), delta.size());
+	}
+	else {
+		records.clear();
+		head = 0;
+	}
+	latest.swap(current);
+}
+
+// Restores the state pushed before the newest one and forgets the newest.
+// Returns false when there is no older frame left.
+bool RewindBuffer::rewind(Chip8& chip8) {
+	if (records.empty()) {
+		return false;
+	}
+
+	Record record = records.back();
+	records.pop_back();
+	applyDelta(latest.data(), latest.size(), &ring[record.offset], record.length);
+	head = record.offset;
+
+	return chip8.loadState(latest.data(), latest.size());
+}
+
+// Copies a record into the ring after the newest one, evicting the oldest records
+// it overwrites
+void RewindBuffer::store(const uint8_t* data, size_t length) {
+	if (length > ring.size()) {
+		records.clear();
+		head = 0;
+		return;
+	}
+
+	if (head + length > ring.size()) {
+		// Everything between head and the end of the ring is older than what sits
+		// at the start, so it goes first
+		while (!records.empty() && records.front().offset >= head) {
+			records.pop_front();
+		}
+		head = 0;
+	}
+
+	while (!records.empty() && records.front().offset < head + length && records.front().offset + records.front().length > head) {
+		records.pop_front();
+	}
+
+	std::memcpy(&ring[head], data, length);
+	records.push_back({ head, length });
+	head += length;
+}
+
+void RewindBuffer::encodeDelta(const uint8_t* newer, const uint8_t* older, size_t size) {
+	delta.clear();
+
+	size_t i = 0;
+	while (i < size) {
+		size_t zeros = 0;
+		while (i + zeros < size && zeros < MAX_RUN && newer[i + zeros] == older[i + zeros]) {
+			zeros++;
+		}
+		i += zeros;
+
+		// Extend the literal stretch until a long enough unchanged run follows
+		size_t literals = 0, matched = 0;
+		while (i + literals + matched < size && literals + matched < MAX_RUN && matched < MIN_ZERO_RUN) {
+			if (newer[i + literals + matched] == older[i + literals + matched]) {
+				matched++;
+			}
+			else {
+				literals += matched + 1;
+				matched = 0;
+			}
+		}
+
+		putCount(delta, zeros);
+		putCount(delta, literals);
+		for (size_t j = 0; j < literals; j++) {
+			delta.push_back(newer[i + j] ^ older[i + j]);
+		}
+		i += literals;
+	}
+}
+
+void RewindBuffer::applyDelta(uint8_t* state, size_t size, const uint8_t* data, size_t length) {
+	size_t position = 0;
+	const uint8_t* end = data + length;
+	while (data + 4 <= end) {
+		position += getCount(data);
+		size_t literals = getCount(data + 2);
+		data += 4;
+
+		if (position > size) {
+			break;
+		}
+		literals = std::min({ literals, size - position, static_cast<size_t>(end - data) });
+		for (size_t j = 0; j < literals; j++) {
+			state[position + j] ^= data[j];
+		}
+		position += literals;
+		data += literals;
+	}
+}
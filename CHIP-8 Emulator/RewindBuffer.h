@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "Chip8.h"
+
+// Fixed-size history of save states, one per frame, for stepping a game
+// backwards. Only the newest state is kept whole; every older one is stored as
+// the XOR against its successor, run-length encoded, so a frame where little
+// changed costs a handful of bytes. Once the ring is full the oldest frames are
+// dropped.
+class RewindBuffer {
+public:
+	explicit RewindBuffer(size_t capacity = 4 * 1024 * 1024);
+
+	void push(const Chip8& chip8);
+	bool rewind(Chip8& chip8);
+	void clear();
+
+	size_t frames() const;
+	size_t bytesUsed() const;
+
+private:
+	struct Record {
+		size_t offset;
+		size_t length;
+	};
+
+	std::vector<uint8_t> ring;
+	size_t head;
+	std::deque<Record> records;
+
+	// The newest state in full, and scratch space for the next one
+	std::vector<uint8_t> latest;
+	std::vector<uint8_t> current;
+	std::vector<uint8_t> delta;
+
+	void store(const uint8_t* data, size_t length);
+	void encodeDelta(const uint8_t* newer, const uint8_t* older, size_t size);
+	static void applyDelta(uint8_t* state, size_t size, const uint8_t* data, size_t length);
+};
@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lock-free ring of audio samples between exactly one producer thread and one
+// consumer thread. Each side owns one index and only reads the other's, so
+// neither ever blocks; a full ring drops writes and an empty one short-reads.
+class SampleRing {
+public:
+	// capacity is rounded up to a power of two
+	explicit SampleRing(size_t capacity) : head(0), tail(0) {
+		size_t size = 1;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		buffer.assign(size, 0);
+		mask = size - 1;
+	}
+
+	size_t capacity() const {
+		return buffer.size();
+	}
+
+	// Samples waiting to be read; exact from either side, a lower bound otherwise
+	size_t size() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	// Producer side. Returns how many of count samples fit.
+	size_t write(const int16_t* samples, size_t count) {
+		size_t writeIndex = head.load(std::memory_order_relaxed);
+		size_t space = buffer.size() - (writeIndex - tail.load(std::memory_order_acquire));
+		if (count > space) {
+			count = space;
+		}
+		for (size_t i = 0; i < count; i++) {
+			buffer[(writeIndex + i) & mask] = samples[i];
+		}
+		head.store(writeIndex + count, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer side. Returns how many of count samples were available.
+	size_t read(int16_t* samples, size_t count) {
+		size_t readIndex = tail.load(std::memory_order_relaxed);
+		size_t available = head.load(std::memory_order_acquire) - readIndex;
+		if (count > available) {
+			count = available;
+		}
+		for (size_t i = 0; i < count; i++) {
+			samples[i] = buffer[(readIndex + i) & mask];
+		}
+		tail.store(readIndex + count, std::memory_order_release);
+		return count;
+	}
+
+private:
+	std::vector<int16_t> buffer;
+	size_t mask;
+	// Free-running counts of samples written and read, on separate cache lines so
+	// the two threads don't contend
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
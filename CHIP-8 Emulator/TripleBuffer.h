@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest of a stream of values from one producer thread to one
+// consumer thread without either waiting. The producer fills the back buffer and
+// publishes it by swapping it with the middle one; the consumer takes the middle
+// one by swapping it with the front. Values the consumer is too slow for are
+// overwritten, so it always gets the newest.
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() : backIndex(0), frontIndex(2), middle(1) {
+	}
+
+	// Producer side: the buffer to fill, then make it the newest
+	T& back() {
+		return buffers[backIndex];
+	}
+
+	void publish() {
+		backIndex = middle.exchange(static_cast<uint8_t>(backIndex | FRESH), std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Consumer side: moves the newest published value to front(), returning false
+	// if nothing was published since the last call
+	bool update() {
+		if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+			return false;
+		}
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	const T& front() const {
+		return buffers[frontIndex];
+	}
+
+private:
+	static const uint8_t INDEX = 0x3;
+	// Set in middle when it holds a value the consumer hasn't taken yet
+	static const uint8_t FRESH = 0x4;
+
+	T buffers[3];
+	uint8_t backIndex;
+	uint8_t frontIndex;
+	std::atomic<uint8_t> middle;
+};
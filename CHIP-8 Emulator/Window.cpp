@@ -1,11 +1,15 @@
 #include "Window.h"
+#include <algorithm>
 
-Window::Window(char const* windowTitle, const int windowHeight, const int windowWidth, int textureWidth, int textureHeight) {
+#include "Chip8.h"
+
+Window::Window(char const* windowTitle, const int windowHeight, const int windowWidth, const PostProcessSettings& filters)
+	: texture(nullptr), postProcessor(filters), autoScale(filters.scale == 0), redraw(false), resized(false) {
 	SDL_InitSubSystem(SDL_INIT_VIDEO);
 	window = SDL_CreateWindow(windowTitle, 0, 0, windowWidth, windowHeight, SDL_WINDOW_RESIZABLE);
 	SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
 	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+	resizeTexture();
 }
 
 Window::~Window() {
@@ -17,138 +21,145 @@ Window::~Window() {
 	SDL_Quit();
 }
 
-void Window::update(void const* buffer, int pitch) {
-	SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+// Advances the post-processor to video and uploads and presents the rows that
+// changed. Returns false, without presenting, if nothing did.
+bool Window::update(const uint64_t* video) {
+	uint32_t rows = postProcessor.step(video);
+	if (!rows) {
+		return false;
+	}
+	draw(rows);
+	present();
+	return true;
+}
+
+// True while the phosphors are still fading and update() should keep being
+// called once a frame
+bool Window::fading() const {
+	return postProcessor.fading();
+}
+
+// The texture is at output resolution. Filters that only work at CHIP-8
+// resolution leave the scaling to SDL_RenderCopy, so an automatic scale is 1
+// unless scanlines or Scale2x need the real pixels.
+void Window::resizeTexture() {
+	if (autoScale) {
+		int scale = 1;
+		if (postProcessor.needsOutputResolution()) {
+			int outputWidth, outputHeight;
+			if (SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight) == 0) {
+				scale = std::min(outputWidth / static_cast<int>(VIDEO_WIDTH), outputHeight / static_cast<int>(VIDEO_HEIGHT));
+			}
+		}
+		int previousScale = postProcessor.scale();
+		postProcessor.setScale(scale);
+		if (texture && postProcessor.scale() == previousScale) {
+			return;
+		}
+	}
+	else if (texture) {
+		return;
+	}
+
+	if (texture) {
+		SDL_DestroyTexture(texture);
+	}
+	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+		postProcessor.outputWidth(), postProcessor.outputHeight());
+	draw(0xFFFFFFFF);
+}
+
+// Renders the output for the display rows in the rows mask straight into the
+// streaming texture, with no staging copy. Locked texture memory is write-only,
+// so the whole band from the first changed row to the last is rewritten.
+void Window::draw(uint32_t rows) {
+	if (postProcessor.readsNeighbours()) {
+		rows |= (rows << 1) | (rows >> 1);
+	}
+
+	unsigned firstRow = 0, lastRow = VIDEO_HEIGHT - 1;
+	while (!(rows & (1u << firstRow))) {
+		firstRow++;
+	}
+	while (!(rows & (1u << lastRow))) {
+		lastRow--;
+	}
+
+	int scale = postProcessor.scale();
+	SDL_Rect area = { 0, static_cast<int>(firstRow) * scale, postProcessor.outputWidth(), static_cast<int>(lastRow - firstRow + 1) * scale };
+	void* pixels;
+	int pitch;
+	if (SDL_LockTexture(texture, &area, &pixels, &pitch) == 0) {
+		postProcessor.render(firstRow, lastRow, static_cast<uint8_t*>(pixels), pitch);
+		SDL_UnlockTexture(texture);
+	}
+}
+
+// Draws the current texture contents without uploading anything
+void Window::present() {
+	if (resized) {
+		resizeTexture();
+		resized = false;
+	}
+
 	SDL_RenderClear(renderer);
 	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 	SDL_RenderPresent(renderer);
+	redraw = false;
 }
 
-// Checks for key down and sets appropriate place in keys array to 1 and sets 0 on key up. Return true if program 
-// should quit, otherwise false.
-bool Window::processInput(uint8_t* keys) {
+// True when the window was exposed or resized and has to be presented again even
+// though the display did not change
+bool Window::needsRedraw() const {
+	return redraw;
+}
+
+void Window::setTitle(char const* title) {
+	SDL_SetWindowTitle(window, title);
+}
+
+// Drains the SDL event queue, waiting up to timeoutMs for the first event, and
+// hands keypad keys to input. Return true if program should quit, otherwise
+// false. rewinding is set while Backspace is held. Keypad presses are timed by
+// tracer when given.
+bool Window::processInput(Input& input, bool& rewinding, LatencyTracer* tracer, int timeoutMs) {
 	bool quit = false;
 	SDL_Event event;
 
-	while (SDL_PollEvent(&event)) {
+	int pending = timeoutMs > 0 ? SDL_WaitEventTimeout(&event, timeoutMs) : SDL_PollEvent(&event);
+	for (; pending; pending = SDL_PollEvent(&event)) {
 		switch (event.type) {
 			case SDL_QUIT:
 				quit = true;
 				break;
+			case SDL_WINDOWEVENT:
+				if (event.window.event == SDL_WINDOWEVENT_EXPOSED || event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+					redraw = true;
+				}
+				if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+					resized = true;
+				}
+				break;
 			case SDL_KEYDOWN:
-				switch (event.key.keysym.sym) {
-					case SDLK_ESCAPE:
-						quit = true;
-						break;
-					case SDLK_x:
-						keys[0] = 1;
-						break;
-					case SDLK_1:
-						keys[1] = 1;
-						break;
-					case SDLK_2:
-						keys[2] = 1;
-						break;
-					case SDLK_3:
-						keys[3] = 1;
-						break;
-					case SDLK_q:
-						keys[4] = 1;
-						break;
-					case SDLK_w:
-						keys[5] = 1;
-						break;
-					case SDLK_e:
-						keys[6] = 1;
-						break;
-					case SDLK_a:
-						keys[7] = 1;
-						break;
-					case SDLK_s:
-						keys[8] = 1;
-						break;
-					case SDLK_d:
-						keys[9] = 1;
-						break;
-					case SDLK_z:
-						keys[10] = 1;
-						break;
-					case SDLK_c:
-						keys[11] = 1;
-						break;
-					case SDLK_4:
-						keys[12] = 1;
-						break;
-					case SDLK_r:
-						keys[13] = 1;
-						break;
-					case SDLK_f:
-						keys[14] = 1;
-						break;
-					case SDLK_v:
-						keys[15] = 1;
-						break;
-					default:
-						break;
+			case SDL_KEYUP: {
+				// The press time has to be stored before the key is published,
+				// or the emulation thread could latch it with a stale time
+				uint8_t key = input.keyFor(event.key.keysym.scancode);
+				if (key != NO_KEY) {
+					if (tracer && event.type == SDL_KEYDOWN && !event.key.repeat) {
+						tracer->keyPressed(key, LatencyTracer::Clock::now());
+					}
+					input.handleKey(event.key);
+					break;
+				}
+				if (event.key.keysym.sym == SDLK_ESCAPE) {
+					quit = true;
+				}
+				else if (event.key.keysym.sym == SDLK_BACKSPACE) {
+					rewinding = event.type == SDL_KEYDOWN;
 				}
 				break;
-			case SDL_KEYUP:
-				switch (event.key.keysym.sym) {
-					case SDLK_ESCAPE:
-						quit = true;
-						break;
-					case SDLK_x:
-						keys[0] = 0;
-						break;
-					case SDLK_1:
-						keys[1] = 0;
-						break;
-					case SDLK_2:
-						keys[2] = 0;
-						break;
-					case SDLK_3:
-						keys[3] = 0;
-						break;
-					case SDLK_q:
-						keys[4] = 0;
-						break;
-					case SDLK_w:
-						keys[5] = 0;
-						break;
-					case SDLK_e:
-						keys[6] = 0;
-						break;
-					case SDLK_a:
-						keys[7] = 0;
-						break;
-					case SDLK_s:
-						keys[8] = 0;
-						break;
-					case SDLK_d:
-						keys[9] = 0;
-						break;
-					case SDLK_z:
-						keys[10] = 0;
-						break;
-					case SDLK_c:
-						keys[11] = 0;
-						break;
-					case SDLK_4:
-						keys[12] = 0;
-						break;
-					case SDLK_r:
-						keys[13] = 0;
-						break;
-					case SDLK_f:
-						keys[14] = 0;
-						break;
-					case SDLK_v:
-						keys[15] = 0;
-						break;
-					default:
-						break;
 			}
-			break;
 		}
 	}
 	return quit;
@@ -1,16 +1,31 @@
 #pragma once
 #include "SDL.h"
 
+#include "Input.h"
+#include "LatencyTracer.h"
+#include "PostProcess.h"
+
 class Window {
 public:
-	Window(char const* title, const int windowHeight, const int windowWidth, int textureWidth, int textureHeight);
+	Window(char const* title, const int windowHeight, const int windowWidth, const PostProcessSettings& filters);
 	~Window();
 
-	void update(void const* buffer, int pitch);
-	bool processInput(uint8_t* keys);
+	bool update(const uint64_t* video);
+	bool fading() const;
+	void present();
+	bool needsRedraw() const;
+	void setTitle(char const* title);
+	bool processInput(Input& input, bool& rewinding, LatencyTracer* tracer = nullptr, int timeoutMs = 0);
 private:
 	SDL_Window* window;
 	SDL_Renderer* renderer;
 	SDL_Texture* texture;
+	PostProcessor postProcessor;
+	bool autoScale;
+	bool redraw;
+	bool resized;
+
+	void resizeTexture();
+	void draw(uint32_t rows);
 };
 
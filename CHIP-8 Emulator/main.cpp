@@ -1,39 +1,261 @@
+#include <atomic>
 #include <iostream>
+#include <fstream>
 #include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
+#include "Audio.h"
 #include "Chip8.h"
+#include "Input.h"
+#include "LatencyTracer.h"
+#include "Movie.h"
+#include "RewindBuffer.h"
+#include "TripleBuffer.h"
 #include "Window.h"
 
+// The display as the emulation thread publishes it
+struct Frame {
+	uint64_t video[VIDEO_HEIGHT];
+	// Frames run when it was published
+	uint64_t number;
+};
+
 int main(int argc, char* argv[]) {
-	int videoScale = 8, cycleDelay = 1;
+	typedef std::chrono::steady_clock Clock;
+
+	int videoScale = 8;
 	char const* romFilename = "test_opcode.ch8";
+	char const* windowTitle = "CHIP-8 Emulator";
 
-	Window window("CHIP-8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
+	// Usage: [rom] [--record movie | --play movie] [--keymap file] [--latency report.json]
+	//        [--persistence 0-1] [--scale n] [--scanlines] [--scale2x]
+	PostProcessSettings filters;
+	char const* recordFilename = nullptr;
+	char const* playFilename = nullptr;
+	char const* keymapFilename = nullptr;
+	char const* latencyFilename = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			recordFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+			playFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--keymap") == 0 && i + 1 < argc) {
+			keymapFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+			latencyFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--persistence") == 0 && i + 1 < argc) {
+			filters.persistence = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+			filters.scale = std::atoi(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--scanlines") == 0) {
+			filters.scanlines = true;
+		}
+		else if (std::strcmp(argv[i], "--scale2x") == 0) {
+			filters.scale2x = true;
+		}
+		else {
+			romFilename = argv[i];
+		}
+	}
+
+	// Frames that may be run back to back to catch up after a stall before the
+	// schedule is reset instead
+	const unsigned MAX_CATCH_UP_FRAMES = 4;
+	const Clock::duration frameDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / FRAME_RATE));
 
 	Chip8 chip8;
-	chip8.load_rom(romFilename);
+	if (!chip8.load_rom(romFilename)) {
+		std::cerr << "Failed to open ROM file " << romFilename << std::endl;
+		return 1;
+	}
+
+	Window window(windowTitle, VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, filters);
+
+	Input input;
+	if (keymapFilename) {
+		input.loadKeymap(keymapFilename);
+	}
+
+	// A movie seeds the machine itself, so recordings get a fresh seed here
+	Movie movie;
+	size_t movieFrame = 0;
+	bool playing = false;
+	if (playFilename) {
+		playing = movie.load(playFilename);
+	}
+	else {
+		movie.seed = static_cast<uint32_t>(std::chrono::system_clock::now().time_since_epoch().count());
+		movie.cyclesPerFrame = chip8.cyclesPerFrame;
+	}
+	movie.start(chip8);
+
+	// Times key presses from the keyboard to the screen
+	LatencyTracer tracer;
+
+	Audio audio;
+
+	// One state per frame, minutes of history in a few MB
+	RewindBuffer rewindBuffer;
 
-	int videoPitch = sizeof(chip8.video[0]) * VIDEO_WIDTH;
+	// The machine runs on its own thread, on its own schedule, and publishes the
+	// display whenever it changes. This thread only polls events and renders, so a
+	// slow present or a compositor stall never holds up emulation.
+	TripleBuffer<Frame> frames;
+	std::atomic<bool> running(true);
+	std::atomic<bool> rewinding(false);
+	// Share of the frame budget the emulation thread spent awake, in tenths of a percent
+	std::atomic<unsigned> budgetUsed(0);
 
-	auto lastCycleTime = std::chrono::high_resolution_clock::now();
+	Clock::duration totalBusyTime(0);
+	unsigned long long totalFrames = 0;
+
+	std::thread emulation([&]() {
+		auto nextFrame = Clock::now();
+		auto reportStart = nextFrame;
+		Clock::duration busyTime(0);
+
+		while (running.load(std::memory_order_relaxed)) {
+			auto wakeTime = Clock::now();
+
+			unsigned framesRun = 0;
+			while (nextFrame <= wakeTime && framesRun < MAX_CATCH_UP_FRAMES) {
+				// Key presses reach the machine only here, between frames
+				uint16_t pressed;
+				chip8.keys = input.latch(&pressed);
+				tracer.latched(pressed, Clock::now());
+				if (playing && !movie.play(chip8, movieFrame++)) {
+					std::cout << "Movie finished after " << movie.frames.size() << " frames" << std::endl;
+					playing = false;
+				}
+
+				if (rewinding.load(std::memory_order_relaxed) && !playing) {
+					// Step back a frame but keep the keys the player is holding now
+					uint16_t keys = chip8.keys;
+					if (rewindBuffer.rewind(chip8) && recordFilename && !movie.frames.empty()) {
+						movie.frames.pop_back();
+					}
+					chip8.keys = keys;
+					audio.pushFrame(false);
+				}
+				else {
+					if (recordFilename) {
+						movie.record(chip8);
+					}
+					tracer.beforeFrame(chip8);
+					chip8.runFrame();
+					tracer.afterFrame(chip8, totalFrames + framesRun + 1, Clock::now());
+					audio.pushFrame(chip8.soundTimer > 0);
+					rewindBuffer.push(chip8);
+				}
+				nextFrame += frameDuration;
+				framesRun++;
+			}
+			if (nextFrame <= wakeTime) {
+				nextFrame = wakeTime + frameDuration;
+			}
+
+			totalFrames += framesRun;
+
+			// Publish the display only when it changed
+			if (chip8.dirtyRows) {
+				chip8.dirtyRows = 0;
+				Frame& frame = frames.back();
+				std::memcpy(frame.video, chip8.video, sizeof(frame.video));
+				frame.number = totalFrames;
+				frames.publish();
+			}
+
+			auto doneTime = Clock::now();
+			busyTime += doneTime - wakeTime;
+
+			// Measure the share of the frame budget spent awake once a second
+			if (doneTime - reportStart >= std::chrono::seconds(1)) {
+				budgetUsed.store(static_cast<unsigned>(1000.0 * busyTime.count() / (doneTime - reportStart).count()),
+					std::memory_order_relaxed);
+
+				totalBusyTime += busyTime;
+				busyTime = Clock::duration(0);
+				reportStart = doneTime;
+			}
+
+			std::this_thread::sleep_until(nextFrame);
+		}
+
+		totalBusyTime += busyTime;
+		tracer.collect();
+	});
+
+	// Fading phosphors are stepped once a frame after the display stops changing
+	auto nextFade = Clock::now();
+	unsigned titleBudget = 0;
+	bool rewindHeld = false;
 	bool quit = false;
 
 	while (!quit)
 	{
-		quit = window.processInput(chip8.keys);
+		quit = window.processInput(input, rewindHeld, &tracer, 1);
+		rewinding.store(rewindHeld, std::memory_order_relaxed);
 
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
+		// Upload and present only when the picture changed, and then only the
+		// band of rows that did. Frames this thread was too slow for are skipped.
+		bool published = frames.update();
+		auto now = Clock::now();
+		if (published || (window.fading() && now >= nextFade)) {
+			nextFade = now + frameDuration;
+			const Frame& frame = frames.front();
+			if (window.update(frame.video)) {
+				tracer.presented(frame.number, Clock::now());
+			}
+		}
+		else if (window.needsRedraw()) {
+			window.present();
+		}
 
-		if (dt > cycleDelay)
-		{
-			lastCycleTime = currentTime;
+		unsigned used = budgetUsed.load(std::memory_order_relaxed);
+		if (used != titleBudget) {
+			char title[128];
+			std::snprintf(title, sizeof(title), "%s - %.1f%% of frame budget", windowTitle, used / 10.0);
+			window.setTitle(title);
+			titleBudget = used;
+		}
+	}
 
-			chip8.cycle();
+	running.store(false, std::memory_order_relaxed);
+	emulation.join();
 
-			window.update(chip8.video, videoPitch);
+	if (totalFrames > 0) {
+		double budgetMs = 1000.0 / FRAME_RATE;
+		double busyMs = std::chrono::duration<double, std::milli>(totalBusyTime).count() / totalFrames;
+		std::cout << "Ran " << totalFrames << " frames, " << busyMs << " ms of each " << budgetMs << " ms frame ("
+			<< 100.0 * busyMs / budgetMs << "% of budget)" << std::endl;
+	}
+
+	if (tracer.histogram(LatencyStage::TOTAL).count() > 0) {
+		std::cout << "Input latency:" << std::endl;
+		tracer.writeSummary(std::cout);
+	}
+	if (latencyFilename) {
+		std::ofstream latencyFile(latencyFilename);
+		if (latencyFile.is_open()) {
+			tracer.writeJson(latencyFile);
+		}
+		else {
+			std::cerr << "Failed to open " << latencyFilename << std::endl;
 		}
 	}
 
+	if (recordFilename) {
+		movie.save(recordFilename);
+	}
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,117 @@
+#include "BatchRunner.h"
+#include "WorkStealingPool.h"
+#include "Chip8.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// source is either a directory, searched recursively for .ch8 files, or a
+// manifest listing one ROM path per line relative to the manifest itself
+bool collectRoms(const std::string& source, std::vector<std::string>& roms) {
+	std::error_code error;
+	if (fs::is_directory(source, error)) {
+		for (fs::recursive_directory_iterator it(source, error), end; !error && it != end; it.increment(error)) {
+			if (it->is_regular_file(error) && it->path().extension() == ".ch8") {
+				roms.push_back(it->path().string());
+			}
+		}
+		std::sort(roms.begin(), roms.end());
+	}
+	else {
+		std::ifstream manifest(source);
+		if (!manifest.is_open()) {
+			std::cerr << "Failed to open ROM directory or manifest " << source << std::endl;
+			return false;
+		}
+
+		fs::path base = fs::path(source).parent_path();
+		std::string line;
+		while (std::getline(manifest, line)) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			fs::path rom(line);
+			roms.push_back((rom.is_absolute() ? rom : base / rom).string());
+		}
+	}
+
+	if (error) {
+		std::cerr << "Failed to list " << source << ": " << error.message() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+static void runRom(const std::string& rom, const BatchOptions& options, BatchResult& result) {
+	result.rom = rom;
+
+	Chip8 chip8;
+	chip8.cyclesPerFrame = options.cyclesPerFrame;
+	chip8.randomGen.seed(options.seed);
+	if (!chip8.load_rom(rom.c_str())) {
+		return;
+	}
+	result.loaded = true;
+
+	auto startTime = std::chrono::steady_clock::now();
+
+	// Whole frames so timers still tick at the right rate, then whatever is left
+	unsigned long long remaining = options.cycleBudget;
+	while (remaining >= options.cyclesPerFrame) {
+		chip8.runFrame();
+		remaining -= options.cyclesPerFrame;
+	}
+	chip8.runBatch(static_cast<unsigned>(remaining));
+
+	result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+	result.instructions = options.cycleBudget;
+	result.idleInstructions = chip8.idleInstructions;
+	result.videoHash = chip8.hashVideo();
+}
+
+// Runs every ROM in its own Chip8 on a pool sized to the machine. Results come
+// back in the same order as roms.
+std::vector<BatchResult> runRomBatch(const std::vector<std::string>& roms, const BatchOptions& options) {
+	std::vector<BatchResult> results(roms.size());
+	WorkStealingPool pool(options.threads);
+
+	for (size_t i = 0; i < roms.size(); i++) {
+		pool.submit([&roms, &options, &results, i] {
+			runRom(roms[i], options, results[i]);
+		});
+	}
+	pool.wait();
+
+	return results;
+}
+
+void writeBatchResults(const std::vector<BatchResult>& results, std::ostream& out) {
+	out << "rom,status,instructions,idle_instructions,video_hash,wall_ms,instructions_per_sec\n";
+	for (const BatchResult& result : results) {
+		char line[160];
+		// Only instructions actually run count towards the speed
+		double perSecond = result.wallMs > 0 ? (result.instructions - result.idleInstructions) / (result.wallMs / 1000.0) : 0.0;
+		std::snprintf(line, sizeof(line), ",%s,%llu,%llu,%016llx,%.3f,%.0f\n", result.loaded ? "ok" : "load_failed",
+			result.instructions, result.idleInstructions, static_cast<unsigned long long>(result.videoHash), result.wallMs,
+			perSecond);
+
+		// Quote the path, it may contain commas
+		out << '"';
+		for (char c : result.rom) {
+			if (c == '"') {
+				out << '"';
+			}
+			out << c;
+		}
+		out << '"' << line;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BatchOptions {
+	unsigned long long cycleBudget = 1000000;
+	unsigned cyclesPerFrame = 10;
+	unsigned threads = 0;
+	unsigned long seed = 0;
+};
+
+struct BatchResult {
+	std::string rom;
+	bool loaded = false;
+	unsigned long long instructions = 0;
+	// Part of instructions skipped as a wait or halt loop instead of being run
+	unsigned long long idleInstructions = 0;
+	uint64_t videoHash = 0;
+	double wallMs = 0;
+};
+
+bool collectRoms(const std::string& source, std::vector<std::string>& roms);
+std::vector<BatchResult> runRomBatch(const std::vector<std::string>& roms, const BatchOptions& options);
+void writeBatchResults(const std::vector<BatchResult>& results, std::ostream& out);
@@ -0,0 +1,100 @@
+#include "WorkStealingPool.h"
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(unsigned threadCount)
+	: queued(0), pending(0), nextQueue(0), stopping(false) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	for (unsigned i = 0; i < threadCount; i++) {
+		queues.emplace_back(new Queue());
+	}
+	for (unsigned i = 0; i < threadCount; i++) {
+		workers.emplace_back(&WorkStealingPool::work, this, i);
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workAvailable.notify_all();
+
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+unsigned WorkStealingPool::size() const {
+	return static_cast<unsigned>(workers.size());
+}
+
+// Tasks are dealt round-robin; stealing takes care of any imbalance
+void WorkStealingPool::submit(std::function<void()> task) {
+	Queue& queue = *queues[nextQueue++ % queues.size()];
+	pending++;
+
+	// Count the task before it becomes visible so queued never drops below zero
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		queued++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	workAvailable.notify_one();
+}
+
+// Blocks until every submitted task has finished
+void WorkStealingPool::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	allDone.wait(lock, [this] { return pending == 0; });
+}
+
+bool WorkStealingPool::take(unsigned self, std::function<void()>& task) {
+	{
+		Queue& own = *queues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned offset = 1; offset < queues.size(); offset++) {
+		Queue& victim = *queues[(self + offset) % queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkStealingPool::work(unsigned self) {
+	for (;;) {
+		std::function<void()> task;
+		if (take(self, task)) {
+			queued--;
+			task();
+
+			if (--pending == 0) {
+				std::lock_guard<std::mutex> lock(mutex);
+				allDone.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		workAvailable.wait(lock, [this] { return stopping || queued > 0; });
+		if (stopping && queued == 0) {
+			return;
+		}
+	}
+}
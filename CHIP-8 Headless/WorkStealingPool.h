@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size thread pool where every worker owns a task queue. Workers take
+// their own newest task first and steal the oldest task from another worker
+// once their queue runs dry, so long and short jobs even out across cores.
+class WorkStealingPool {
+public:
+	// threadCount 0 means one worker per hardware thread
+	explicit WorkStealingPool(unsigned threadCount = 0);
+	~WorkStealingPool();
+
+	void submit(std::function<void()> task);
+	void wait();
+
+	unsigned size() const;
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable allDone;
+	std::atomic<unsigned> queued;
+	std::atomic<unsigned> pending;
+	std::atomic<unsigned> nextQueue;
+	bool stopping;
+
+	void work(unsigned self);
+	bool take(unsigned self, std::function<void()>& task);
+};
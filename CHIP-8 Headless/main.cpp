@@ -0,0 +1,326 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+
+#include "Chip8.h"
+#include "Chip8Jit.h"
+#include "Movie.h"
+#include "BatchRunner.h"
+
+// Runs a ROM without a display and prints the final machine state, for
+// regression and soak tests on machines without SDL.
+
+struct KeyEvent {
+	unsigned long long frame;
+	uint8_t key;
+	bool down;
+};
+
+static void printUsage() {
+	std::cout <<
+		"Usage: chip8-headless <rom> [options]\n"
+		"       chip8-headless --batch <directory|manifest> [batch options]\n"
+		"  --frames N            run N 60 Hz frames (default 600)\n"
+		"  --cycles N            run N instructions instead of a frame budget\n"
+		"  --cycles-per-frame N  instructions per frame (default 10)\n"
+		"  --engine NAME         cycle, batch or jit (default batch)\n"
+		"  --input FILE          scripted input, lines of \"<frame> <key> down|up\"\n"
+		"  --movie FILE          replay a recorded movie: its seed, frame length and keys;\n"
+		"                        runs for the length of the movie unless --frames is given\n"
+		"  --seed N              seed for the random number generator (default 0)\n"
+		"  --hash-every N        print the framebuffer hash every N frames\n"
+		"Batch options:\n"
+		"  --cycles N            instructions per ROM (default 1000000)\n"
+		"  --cycles-per-frame N  instructions per frame (default 10)\n"
+		"  --threads N           worker threads (default: one per hardware thread)\n"
+		"  --seed N              seed for every ROM's random number generator (default 0)\n"
+		"  --output FILE         write the CSV results to FILE instead of stdout\n";
+}
+
+// Runs every ROM under a directory or in a manifest across all cores and writes
+// one CSV record per ROM
+static int runBatchMode(int argc, char* argv[]) {
+	BatchOptions options;
+	const char* outputFilename = nullptr;
+
+	for (int i = 3; i < argc; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (option == "--cycles") {
+			options.cycleBudget = std::strtoull(value, nullptr, 10);
+		}
+		else if (option == "--cycles-per-frame") {
+			options.cyclesPerFrame = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+		}
+		else if (option == "--threads") {
+			options.threads = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+		}
+		else if (option == "--seed") {
+			options.seed = std::strtoul(value, nullptr, 10);
+		}
+		else if (option == "--output") {
+			outputFilename = value;
+		}
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (options.cyclesPerFrame == 0) {
+		std::cerr << "--cycles-per-frame must be at least 1" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> roms;
+	if (!collectRoms(argv[2], roms)) {
+		return 1;
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	std::vector<BatchResult> results = runRomBatch(roms, options);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	if (outputFilename) {
+		std::ofstream output(outputFilename);
+		if (!output.is_open()) {
+			std::cerr << "Failed to open " << outputFilename << std::endl;
+			return 1;
+		}
+		writeBatchResults(results, output);
+	}
+	else {
+		writeBatchResults(results, std::cout);
+	}
+
+	size_t failed = std::count_if(results.begin(), results.end(), [](const BatchResult& result) {
+		return !result.loaded;
+	});
+	std::cerr << "Ran " << results.size() - failed << " of " << results.size() << " ROMs in " << seconds << " s" << std::endl;
+	return failed ? 2 : 0;
+}
+
+// Reads "<frame> <key in hex> down|up" lines; blank lines and lines starting with
+// '#' are ignored
+static bool loadInputScript(const char* filename, std::vector<KeyEvent>& events) {
+	std::ifstream file(filename);
+	if (!file.is_open()) {
+		std::cerr << "Failed to open input script " << filename << std::endl;
+		return false;
+	}
+
+	std::string line;
+	unsigned lineNumber = 0;
+	while (std::getline(file, line)) {
+		lineNumber++;
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		KeyEvent event;
+		unsigned key;
+		std::string state;
+		if (!(fields >> event.frame >> std::hex >> key >> state) || key > 0xF || (state != "down" && state != "up")) {
+			std::cerr << filename << ":" << lineNumber << ": expected \"<frame> <key> down|up\"" << std::endl;
+			return false;
+		}
+		event.key = static_cast<uint8_t>(key);
+		event.down = state == "down";
+		events.push_back(event);
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const KeyEvent& a, const KeyEvent& b) {
+		return a.frame < b.frame;
+	});
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printUsage();
+		return 1;
+	}
+	if (std::strcmp(argv[1], "--batch") == 0) {
+		if (argc < 3) {
+			printUsage();
+			return 1;
+		}
+		return runBatchMode(argc, argv);
+	}
+
+	const char* romFilename = argv[1];
+	const char* inputFilename = nullptr;
+	const char* movieFilename = nullptr;
+	bool framesGiven = false;
+	std::string engine = "batch";
+	unsigned long long frameBudget = 600, cycleBudget = 0, hashEvery = 0;
+	unsigned cyclesPerFrame = 10;
+	bool seeded = false;
+	unsigned long seed = 0;
+
+	for (int i = 2; i < argc; i++) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (option == "--frames") {
+			frameBudget = std::strtoull(value, nullptr, 10);
+			framesGiven = true;
+		}
+		else if (option == "--cycles") {
+			cycleBudget = std::strtoull(value, nullptr, 10);
+		}
+		else if (option == "--cycles-per-frame") {
+			cyclesPerFrame = static_cast<unsigned>(std::strtoul(value, nullptr, 10));
+		}
+		else if (option == "--engine") {
+			engine = value;
+		}
+		else if (option == "--input") {
+			inputFilename = value;
+		}
+		else if (option == "--movie") {
+			movieFilename = value;
+		}
+		else if (option == "--seed") {
+			seed = std::strtoul(value, nullptr, 10);
+			seeded = true;
+		}
+		else if (option == "--hash-every") {
+			hashEvery = std::strtoull(value, nullptr, 10);
+		}
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (engine != "cycle" && engine != "batch" && engine != "jit") {
+		std::cerr << "Unknown engine " << engine << std::endl;
+		return 1;
+	}
+	if (cyclesPerFrame == 0) {
+		std::cerr << "--cycles-per-frame must be at least 1" << std::endl;
+		return 1;
+	}
+
+	std::vector<KeyEvent> events;
+	if (inputFilename && !loadInputScript(inputFilename, events)) {
+		return 1;
+	}
+
+	Movie movie;
+	if (movieFilename) {
+		if (inputFilename || seeded) {
+			std::cerr << "--movie cannot be combined with --input or --seed" << std::endl;
+			return 1;
+		}
+		if (!movie.load(movieFilename)) {
+			return 1;
+		}
+		cyclesPerFrame = movie.cyclesPerFrame;
+		if (!framesGiven && cycleBudget == 0) {
+			frameBudget = movie.frames.size();
+		}
+	}
+
+	Chip8 chip8;
+	chip8.cyclesPerFrame = cyclesPerFrame;
+	// Always seeded, so runs without --seed are reproducible too
+	chip8.randomGen.seed(seed);
+	if (!chip8.load_rom(romFilename)) {
+		std::cerr << "Failed to open ROM file " << romFilename << std::endl;
+		return 1;
+	}
+
+	if (movieFilename) {
+		movie.start(chip8);
+	}
+
+	// Heap allocated, the JIT block cache is too big for the stack
+	std::unique_ptr<Chip8Jit> jit(engine == "jit" ? new Chip8Jit(chip8) : nullptr);
+
+	// With a cycle budget the last frame may be partial
+	if (cycleBudget > 0) {
+		frameBudget = (cycleBudget + cyclesPerFrame - 1) / cyclesPerFrame;
+	}
+
+	unsigned long long frame = 0, instructions = 0;
+	size_t nextEvent = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
+	for (; frame < frameBudget; frame++) {
+		while (nextEvent < events.size() && events[nextEvent].frame <= frame) {
+			uint16_t bit = static_cast<uint16_t>(1 << events[nextEvent].key);
+			chip8.keys = events[nextEvent].down ? chip8.keys | bit : chip8.keys & ~bit;
+			nextEvent++;
+		}
+		if (movieFilename) {
+			movie.play(chip8, frame);
+		}
+
+		unsigned count = cyclesPerFrame;
+		if (cycleBudget > 0 && cycleBudget - instructions < count) {
+			count = static_cast<unsigned>(cycleBudget - instructions);
+		}
+
+		if (jit) {
+			jit->run(count);
+		}
+		else if (engine == "cycle") {
+			for (unsigned i = 0; i < count; i++) {
+				chip8.cycle();
+			}
+		}
+		else {
+			chip8.runBatch(count);
+		}
+		chip8.tickTimers();
+		instructions += count;
+
+		if (hashEvery > 0 && (frame + 1) % hashEvery == 0) {
+			std::printf("frame %llu hash %016llx\n", frame + 1, static_cast<unsigned long long>(chip8.hashVideo()));
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	std::printf("rom: %s\n", romFilename);
+	std::printf("engine: %s\n", engine.c_str());
+	std::printf("frames: %llu\n", frame);
+	std::printf("instructions: %llu\n", instructions);
+	std::printf("idle_instructions: %llu\n", static_cast<unsigned long long>(chip8.idleInstructions));
+	std::printf("video_hash: %016llx\n", static_cast<unsigned long long>(chip8.hashVideo()));
+	std::printf("pc: %03x\n", chip8.programCounter);
+	std::printf("i: %03x\n", chip8.index);
+	std::printf("sp: %u\n", chip8.stackPointer);
+	std::printf("dt: %u\n", chip8.delayTimer);
+	std::printf("st: %u\n", chip8.soundTimer);
+	std::printf("v:");
+	for (int i = 0; i < 16; i++) {
+		std::printf(" %02x", chip8.registers[i]);
+	}
+	std::printf("\n");
+	std::printf("wall_ms: %.3f\n", seconds * 1000.0);
+	// Only instructions actually run count towards the speed
+	std::printf("instructions_per_sec: %.0f\n", seconds > 0 ? (instructions - chip8.idleInstructions) / seconds : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+# Merges Clang's raw profiles in PGO_DIR into the default.profdata a
+# CHIP8_PGO=USE build reads. Run with cmake -DLLVM_PROFDATA=... -DPGO_DIR=... -P
+file(GLOB RAW_PROFILES "${PGO_DIR}/*.profraw")
+if(NOT RAW_PROFILES)
+	message(FATAL_ERROR "No raw profiles in ${PGO_DIR}")
+endif()
+
+execute_process(
+	COMMAND "${LLVM_PROFDATA}" merge -output=${PGO_DIR}/default.profdata ${RAW_PROFILES}
+	RESULT_VARIABLE MERGE_RESULT
+)
+if(NOT MERGE_RESULT EQUAL 0)
+	message(FATAL_ERROR "llvm-profdata merge failed")
+endif()